@@ -0,0 +1,167 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include <ctime>
+
+#include <sys/stat.h>
+
+#include "AdminConsole.hpp"
+#include "Handoff.hpp"
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+
+static const char* const s_help =
+	"players    all players with status and room\n"
+	"rooms      all rooms with description, info, hidden flag and members\n"
+	"sessions   send queue depth and bytes and TCP statistics of every connection\n"
+	"room ID    current state of the room hosted by player ID\n"
+	"kick ID    closes the connection of client ID\n"
+	"help       this list\n"
+	"quit       closes the console connection\n\n";
+
+
+/*
+	Reads one line at a time and writes its reply before reading the
+	next one. Lines longer than max_line close the connection.
+*/
+class AdminConsole::Connection : public std::enable_shared_from_this<Connection>
+{
+public:
+	Connection( AdminConsole& console, asio::local::stream_protocol::socket socket ) :
+		m_console( console ),
+		m_socket ( std::move( socket ) ),
+		m_input  ( max_line )
+	{};
+
+	void do_read()
+	{
+		auto self( shared_from_this() );
+		asio::async_read_until( m_socket, m_input, '\n',
+		[this, self]( asio::error_code ec, size_t size )
+		{
+			if ( ec ) return;
+			const auto begin = asio::buffers_begin( m_input.data() );
+			const std::string line( begin, begin + size );
+			m_input.consume( size );
+			const auto reply = m_console.execute( line );
+			if ( reply ) do_write( reply );
+		} );
+	}
+
+private:
+	void do_write( const Reply& reply )
+	{
+		auto self( shared_from_this() );
+		asio::async_write( m_socket, asio::buffer( *reply ),
+		[this, self, reply]( asio::error_code ec, size_t )
+		{
+			if ( !ec ) do_read();
+		} );
+	}
+
+	AdminConsole& m_console;
+	asio::local::stream_protocol::socket m_socket;
+	asio::streambuf m_input;
+};
+
+
+/*
+	A stale socket file left by a crashed server (or by the server this
+	one took over from, see Handoff) is replaced. Any other file at path
+	is left alone, the constructor throws instead.
+*/
+AdminConsole::AdminConsole( asio::io_service& io_service, Partitions& partitions, const std::string& path ) :
+	m_partitions( partitions ),
+	m_acceptor  ( io_service ),
+	m_socket    ( io_service )
+{
+	Handoff::remove_stale_socket( path );
+	const asio::local::stream_protocol::endpoint ep( path );
+	m_acceptor.open( ep.protocol() );
+	m_acceptor.bind( ep );
+	::chmod( path.c_str(), S_IRUSR | S_IWUSR );
+	m_acceptor.listen();
+	do_accept();
+}
+
+
+void AdminConsole::do_accept()
+{
+	m_acceptor.async_accept( m_socket,
+	[this]( std::error_code ec )
+	{
+		if ( ec ) return;
+		std::make_shared<Connection>( *this, std::move( m_socket ) )->do_read();
+		do_accept();
+	} );
+}
+
+
+AdminConsole::Reply AdminConsole::execute( const std::string& line )
+{
+	std::istringstream in( line );
+	std::string command;
+	in >> command;
+	unsigned int id = 0;
+	const bool has_id = static_cast<bool>( in >> id );
+
+	if ( "players"  == command ) return snapshot()->players;
+	if ( "rooms"    == command ) return snapshot()->rooms;
+	if ( "sessions" == command ) return snapshot()->sessions;
+	if ( "quit"     == command ) return Reply();
+
+	std::ostringstream out;
+	if ( "room" == command && has_id )
+	{
+		if ( !m_partitions.print_room( id, out ) ) out << "no room hosted by " << id << "\n";
+	}
+	else if ( "kick" == command && has_id )
+	{
+		if ( m_partitions.kick( id ) ) out << "kicked " << id << "\n";
+		else                           out << "no client " << id << "\n";
+	}
+	else if ( "help" == command || command.empty() )
+	{
+		return std::make_shared<const std::string>( s_help );
+	}
+	else
+	{
+		out << "unknown command, try help\n";
+	}
+	out << "\n";
+	return std::make_shared<const std::string>( out.str() );
+}
+
+
+std::shared_ptr<const AdminConsole::Snapshot> AdminConsole::snapshot()
+{
+	const auto now = std::chrono::steady_clock::now();
+	if ( m_snapshot && std::chrono::milliseconds( refresh_ms ) > now - m_snapshot->taken ) return m_snapshot;
+
+	char taken[32];
+	const std::time_t t = std::time( nullptr );
+	std::strftime( taken, sizeof( taken ), "%Y-%m-%d %H:%M:%S", std::localtime( &t ) );
+	const auto render = [&taken]( const std::function<void( std::ostream& )>& print )
+	{
+		std::ostringstream out;
+		out << "as of " << taken << "\n";
+		print( out );
+		out << "\n";
+		return std::make_shared<const std::string>( out.str() );
+	};
+
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->taken    = now;
+	snapshot->players  = render( [this]( std::ostream& out ) { m_partitions.print_players( out ); } );
+	snapshot->rooms    = render( [this]( std::ostream& out ) { m_partitions.print_rooms  ( out ); } );
+	snapshot->sessions = render( [this]( std::ostream& out ) { m_partitions.print_clients( out ); } );
+	m_snapshot = snapshot;
+	return m_snapshot;
+}
+
+#endif
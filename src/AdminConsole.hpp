@@ -0,0 +1,74 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "Partitions.hpp"
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+
+/*
+	Text console on the Unix socket given by --admin, for operators:
+
+		$ socat - UNIX-CONNECT:/tmp/cossacks3-admin.sock
+
+	Every line is one command, every reply ends with an empty line:
+
+		players    all players with status and room
+		rooms      all rooms with description, info, hidden flag and members
+		sessions   send queue depth and bytes and TCP statistics of every connection
+		room ID    current state of the room hosted by player ID
+		kick ID    closes the connection of client ID
+		help       this list
+		quit       closes the console connection
+
+	The tables are read from a snapshot which is rendered at most every
+	refresh_ms and shared by all connections, so an operator polling in
+	a loop (or several of them) costs the event loop one rendering per
+	interval, not one per query. The snapshot is immutable once taken;
+	replies hold a reference to it while they are being written, and
+	all writes are asynchronous. room and kick act on the live state,
+	they touch a single room or connection only.
+
+	The socket file is only accessible by the user running the server.
+*/
+class AdminConsole
+{
+public:
+	enum { refresh_ms = 1000 };
+	enum { max_line   = 256  };
+
+	AdminConsole( asio::io_service& io_service, Partitions& partitions, const std::string& path );
+	AdminConsole( const AdminConsole& ) = delete;
+	AdminConsole& operator =( const AdminConsole& ) = delete;
+
+private:
+	class Connection;
+	typedef std::shared_ptr<const std::string> Reply;
+
+	struct Snapshot
+	{
+		std::chrono::steady_clock::time_point taken;
+		Reply players;
+		Reply rooms;
+		Reply sessions;
+	};
+
+	void do_accept();
+
+	//reply to one command line, empty for quit
+	Reply execute( const std::string& line );
+	//the current snapshot, renders a new one if it is older than refresh_ms
+	std::shared_ptr<const Snapshot> snapshot();
+
+	Partitions& m_partitions;
+	asio::local::stream_protocol::acceptor m_acceptor;
+	asio::local::stream_protocol::socket   m_socket;
+	std::shared_ptr<const Snapshot>        m_snapshot;
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "Admission.hpp"
+
+Admission::Admission( const Options& options ) :
+	m_max_sessions       ( options.max_sessions ),
+	m_max_per_address    ( options.max_per_address ),
+	m_budget             ( static_cast<size_t>( options.memory_budget ) << 20 ),
+	m_sessions           ( 0 ),
+	m_bytes              ( 0 ),
+	m_peak_bytes         ( 0 ),
+	m_refused_sessions   ( 0 ),
+	m_refused_per_address( 0 ),
+	m_refused_budget     ( 0 ),
+	m_deferred_reads     ( 0 )
+{}
+
+
+bool Admission::admit( const std::string& address, size_t initial_bytes )
+{
+	if ( m_max_sessions <= m_sessions )
+	{
+		++m_refused_sessions;
+		warn( address, "too many connections" );
+		return false;
+	}
+	const auto it = m_per_address.find( address );
+	if ( m_per_address.end() != it && m_max_per_address <= it->second )
+	{
+		++m_refused_per_address;
+		warn( address, "too many connections from this address" );
+		return false;
+	}
+	if ( m_budget < m_bytes + initial_bytes )
+	{
+		++m_refused_budget;
+		warn( address, "memory budget exhausted" );
+		return false;
+	}
+	enter( address, initial_bytes );
+	return true;
+}
+
+
+void Admission::enter( const std::string& address, size_t initial_bytes )
+{
+	++m_sessions;
+	++m_per_address[address];
+	charge( initial_bytes );
+}
+
+
+void Admission::leave( const std::string& address )
+{
+	--m_sessions;
+	const auto it = m_per_address.find( address );
+	if ( m_per_address.end() != it && 0 == --it->second ) m_per_address.erase( it );
+}
+
+
+bool Admission::try_charge( size_t bytes )
+{
+	if ( m_budget < m_bytes + bytes ) return false;
+	charge( bytes );
+	return true;
+}
+
+
+void Admission::charge( size_t bytes )
+{
+	m_bytes += bytes;
+	m_peak_bytes = std::max( m_peak_bytes, m_bytes );
+}
+
+
+void Admission::refund( size_t bytes )
+{
+	m_bytes -= std::min( m_bytes, bytes );
+}
+
+
+void Admission::warn( const std::string& address, const char* reason )
+{
+	const auto now = std::chrono::steady_clock::now();
+	if ( now - m_last_warning < std::chrono::seconds( 1 ) ) return;
+	m_last_warning = now;
+	std::cerr << "[WARNING] Refused connection from " << address << ": " << reason
+	          << " (refused so far: " << m_refused_sessions + m_refused_per_address + m_refused_budget << ")\n";
+}
+
+
+void Admission::print( std::ostream& out ) const
+{
+	out << std::dec
+	    << "admission: " << m_sessions << " / " << m_max_sessions << " sessions, "
+	    << ( m_bytes >> 10 ) << " / " << ( m_budget >> 10 ) << " KiB (peak " << ( m_peak_bytes >> 10 ) << " KiB)\n"
+	    << "  refused: " << m_refused_sessions << " session limit, " << m_refused_per_address << " address limit, "
+	    << m_refused_budget << " budget; deferred reads: " << m_deferred_reads << '\n' << std::flush;
+}
@@ -0,0 +1,67 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "Options.hpp"
+
+/*
+	Admission control for client connections. Limits the number of
+	Sessions, the number of concurrent connections per source address and
+	the memory held by all Sessions: receive buffers plus queued sends.
+
+	Receive buffers start small and only grow for big packets if the
+	budget allows it, otherwise the Session defers reading the packet body
+	until memory is available again (see Session::do_read()). Queued sends
+	can not be refused without breaking games, they are charged anyway;
+	a full budget then keeps new connections out. A send buffer shared by
+	the queues of several Sessions (a broadcast) is charged once, see
+	SendBuffer::charge().
+
+	All counters are shown on SIGUSR2 (see Server::do_await_signal()).
+*/
+class Admission
+{
+public:
+	Admission( const Options& options );
+
+	//counts the connection if it is admitted, initial_bytes are charged
+	bool admit( const std::string& address, size_t initial_bytes );
+	//counts the connection without any checks (see Server::take_over())
+	void enter( const std::string& address, size_t initial_bytes );
+	void leave( const std::string& address );
+
+	//for memory which can wait (receive buffers); false if over budget
+	bool try_charge( size_t bytes );
+	//for memory which has to be taken anyway (send queues)
+	void charge( size_t bytes );
+	void refund( size_t bytes );
+
+	void count_deferred_read() { ++m_deferred_reads; };
+
+	void print( std::ostream& out ) const;
+
+private:
+	void warn( const std::string& address, const char* reason );
+
+	const size_t m_max_sessions;
+	const size_t m_max_per_address;
+	const size_t m_budget;//bytes
+
+	size_t                        m_sessions;
+	std::map<std::string, size_t> m_per_address;
+	size_t                        m_bytes;
+	size_t                        m_peak_bytes;
+
+	unsigned long long m_refused_sessions;
+	unsigned long long m_refused_per_address;
+	unsigned long long m_refused_budget;
+	unsigned long long m_deferred_reads;
+
+	//refusals are logged at most once per second
+	std::chrono::steady_clock::time_point m_last_warning;
+};
@@ -7,6 +7,11 @@
 #pragma once
 #include "Precompiled.hpp"
 
+#include "SendBuffer.hpp"
+#include "TcpMonitor.hpp"
+
+class Handoff;
+
 /*
 	Provides a Session interface for the Lobby Object.
 	See Session class for details.
@@ -14,10 +19,33 @@
 class Client
 {
 public:
+	//send queue lanes: game relay and control packets go first, lobby
+	//notifications wait while the player is in a game, see Session
+	enum Lane { GameLane, LobbyLane, lane_count };
+
 	virtual ~Client() {};
-	virtual       void       queue_buf( const BufPtr& buf ) = 0;
+	virtual       void       queue_buf( const BufPtr& buf, Lane lane ) = 0;
+	//more data of a queued stream buffer arrived, see SendBuffer
+	virtual       void stream_progress()                    = 0;
 	virtual       void          set_id( unsigned int id   ) = 0;
 	virtual       unsigned int      id() const              = 0;
 	virtual const std::string& address() const              = 0;
 	virtual       Buffer&          buf()                    = 0;
+
+	//send queue state, used for accounting and diagnostics
+	virtual       size_t   queue_depth() const              = 0;
+	virtual       size_t  queued_bytes() const              = 0;
+	//last kernel connection statistics, see TcpMonitor
+	virtual const TcpMonitor::Stats& tcp_stats() const      = 0;
+
+	//called on game start and when the player leaves the room, see Session
+	virtual       void     set_in_game( bool in_game )      = 0;
+	//closes the connection on request of an operator, see AdminConsole
+	virtual       void            kick()                    = 0;
+
+	//hot restart, see Handoff class
+	virtual       void         suspend()                    = 0;
+	virtual       bool       suspended() const              = 0;
+	virtual       void          resume()                    = 0;
+	virtual       void        hand_off( Handoff& handoff, const std::string& partition ) = 0;
 };
\ No newline at end of file
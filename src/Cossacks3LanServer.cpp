@@ -14,23 +14,38 @@
 */
 #include "Precompiled.hpp"
 
+#include "FlightRecorder.hpp"
+#include "Options.hpp"
 #include "Server.hpp"
 
-int main()
+int main( int argc, char* argv[] )
 {
+	Options options;
+	try
+	{
+		options = parse_options( argc, argv );
+	}
+	catch ( std::invalid_argument& e )
+	{
+		if ( *e.what() ) std::cerr << e.what() << "\n";
+		print_usage( std::cerr );
+		return 1;
+	}
+
 	std::cout << "Cossacks 3 LAN Server starting up...";
 	try
 	{
 		//see asio examples for details about library usage
 		//https://github.com/chriskohlhoff/asio/tree/master/asio/src/examples
 		asio::io_service io_service;
-		Server server( io_service );
-		std::cout << " running on port " << port << std::endl;
+		Server server( io_service, options );
+		std::cout << " running on port " << options.port << std::endl;
 		io_service.run();
 	}
 	catch ( std::exception& e )
 	{
 		std::cerr << "Exception in main(): " << e.what() << "\n";
+		FlightRecorder::dump( std::string( "exception in main(): " ) + e.what(), true );
 	}
 
 	return 0;
@@ -0,0 +1,620 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include <random>
+
+#include "Federation.hpp"
+#include "SendBuffer.hpp"
+
+using namespace asio::ip;
+
+/*
+	A TCP connection to another server. Reads frames like Session does
+	(header, then body) and passes them to Federation::apply(). Keeps the
+	ID mapping for everything received through this link.
+*/
+class Federation::Link : public std::enable_shared_from_this<Link>
+{
+public:
+	//peer is host:port for outgoing links, empty for incoming ones
+	Link( Federation& federation, tcp::socket socket, const std::string& peer ) :
+		remote_instance( 0 ),
+		m_federation   ( federation ),
+		m_socket       ( std::move( socket ) ),
+		m_buf          ( max_frame_size + read_slack ),
+		m_closed       ( false ),
+		m_peer         ( peer ),
+		m_no_retry     ( false )
+	{
+		asio::error_code ec;
+		const auto ep = m_socket.remote_endpoint( ec );
+		m_address = ec ? "?" : ep.address().to_string() + ":" + std::to_string( ep.port() );
+	};
+
+	void start() { do_read_header(); };
+	void send( const BufPtr& buf );
+	//closes the socket once, reconnects outgoing links unless no_retry
+	void close( bool no_retry = false );
+
+	const std::string& peer()    const { return m_peer;     };
+	const std::string& address() const { return m_address;  };
+	bool               outgoing() const { return !m_peer.empty(); };
+	bool               no_retry() const { return m_no_retry; };
+
+	unsigned long long remote_instance;//from Hello record
+	std::string        partition;      //selected by the last Partition record
+
+	//remote Client ID -> local ID, key: partition
+	std::map<std::string, std::map<unsigned int, unsigned int>> players;
+	//remote room host IDs, key: partition
+	std::map<std::string, std::set<unsigned int>>               rooms;
+
+	//malformed records can announce strings up to 64 KiB beyond the frame
+	enum { read_slack = 0x10000 };
+
+private:
+	void do_read_header();
+	void do_read_body( size_t data_size );
+	void do_send();
+
+	Federation&        m_federation;
+	tcp::socket        m_socket;
+	Buffer             m_buf;
+	std::deque<BufPtr> m_queue;
+	bool               m_closed;
+	const std::string  m_peer;
+	bool               m_no_retry;
+	std::string        m_address;
+};
+
+
+void Federation::Link::send( const BufPtr& buf )
+{
+	if ( m_closed ) return;
+	const bool queue_is_empty = m_queue.empty();
+	m_queue.push_back( buf );
+	if ( queue_is_empty ) do_send();
+}
+
+
+void Federation::Link::do_send()
+{
+	auto self( shared_from_this() );
+	asio::async_write( m_socket, asio::buffer( m_queue.front()->data(), m_queue.front()->size() ),
+	[this, self]( asio::error_code ec, std::size_t )
+	{
+		if ( ec )
+		{
+			if ( !m_closed ) std::cerr << "[ERROR] Could not send to federation peer " << m_address << ": " << ec << "\n";
+			close();
+			return;
+		}
+		m_queue.pop_front();
+		if ( !m_queue.empty() ) do_send();
+	} );
+}
+
+
+void Federation::Link::do_read_header()
+{
+	auto self( shared_from_this() );
+	asio::async_read( m_socket, asio::buffer( m_buf, Packet::packet_header_size ),
+	[this, self]( asio::error_code ec, std::size_t )
+	{
+		if ( ec )
+		{
+			close();
+			return;
+		}
+		const Packet p( m_buf, 0 );
+		if ( frame_cmd != p.cmd() || max_frame_size - Packet::packet_header_size < p.size() )
+		{
+			std::cerr << "[ERROR] Invalid frame from federation peer " << m_address << "\n";
+			close();
+			return;
+		}
+		do_read_body( p.size() );
+	} );
+}
+
+
+void Federation::Link::do_read_body( size_t data_size )
+{
+	auto self( shared_from_this() );
+	asio::async_read( m_socket, asio::buffer( &m_buf[Packet::packet_header_size], data_size ),
+	[this, self]( asio::error_code ec, std::size_t )
+	{
+		if ( ec )
+		{
+			close();
+			return;
+		}
+		Packet p( m_buf, 0 );
+		m_federation.apply( *this, p );
+		if ( !m_closed ) do_read_header();
+	} );
+}
+
+
+void Federation::Link::close( bool no_retry )
+{
+	if ( m_closed ) return;
+	m_closed   = true;
+	m_no_retry = no_retry;
+	asio::error_code ec;
+	m_socket.close( ec );
+	m_federation.close_link( *this );
+}
+
+
+/*
+	Collects records into frames of at most max_frame_size bytes. Every
+	frame repeats the current Partition record, so frames can be applied
+	independently.
+*/
+class Federation::Writer
+{
+public:
+	Writer() : m_buf( max_frame_size ), m_p( m_buf, 0 ), m_records( 0 ) { m_p.seek_to_start(); };
+
+	//starts a record of at most size bytes (type byte excluded)
+	Packet& record( Record type, size_t size )
+	{
+		if ( max_frame_size < m_p.seek_pos() + 1 + size + 3 + m_key.size() ) flush();
+		if ( 0 == m_records && Partition != type && !m_key.empty() )
+		{
+			++m_records;
+			m_p.write_byte( Partition );
+			m_p.write_string( m_key, Packet::Short );
+		}
+		++m_records;
+		m_p.write_byte( static_cast<unsigned char>( type ) );
+		return m_p;
+	};
+
+	void partition( const std::string& key )
+	{
+		m_key = key;
+		record( Partition, 2 + key.size() ).write_string( key, Packet::Short );
+	};
+
+	std::vector<BufPtr>& finish() { flush(); return m_frames; };
+
+private:
+	void flush()
+	{
+		if ( 0 == m_records ) return;
+		m_p.write_header( frame_cmd );
+		m_frames.push_back( SendBuffer::create( m_buf.data(), m_p.send_size() ) );
+		m_p.seek_to_start();
+		m_records = 0;
+	};
+
+	Buffer              m_buf;
+	Packet              m_p;
+	size_t              m_records;
+	std::string         m_key;
+	std::vector<BufPtr> m_frames;
+};
+
+
+/*
+	Opens the federation port (if configured), starts linking to all
+	peers and the batch timer.
+*/
+Federation::Federation( asio::io_service& io_service, Partitions& partitions, const Options& options ) :
+	m_io_service ( io_service ),
+	m_partitions ( partitions ),
+	m_acceptor   ( io_service ),
+	m_socket     ( io_service ),
+	m_resolver   ( io_service ),
+	m_batch_timer( io_service ),
+	m_options    ( options ),
+	m_stopped    ( true ),
+	m_instance_id( std::random_device()() * 0x100000000ull + std::random_device()() )
+{
+	m_partitions.set_chat_listener(
+	[this]( const std::string& key, unsigned int id, const std::string& text )
+	{
+		if ( !m_links.empty() ) m_chat[key].emplace_back( id, text );
+	} );
+	start();
+}
+
+
+void Federation::start()
+{
+	m_stopped = false;
+	if ( 0 != m_options.federation_port )
+	{
+		const tcp::endpoint ep( tcp::v4(), m_options.federation_port );
+		m_acceptor.open( ep.protocol() );
+		m_acceptor.set_option( tcp::acceptor::reuse_address( true ) );
+		m_acceptor.bind( ep );
+		m_acceptor.listen();
+		do_accept();
+	}
+	for ( const auto& peer : m_options.peers )
+	{
+		connect( peer );
+	}
+
+	do_batch();
+}
+
+
+/*
+	Closes the links like a connection loss would (removing everything
+	received through them from the partitions), but without reconnecting.
+*/
+void Federation::stop()
+{
+	m_stopped = true;
+	asio::error_code ec;
+	m_acceptor.close( ec );
+	m_batch_timer.cancel();
+
+	const auto links = m_links;
+	for ( const auto& link : links ) link->close( true );
+	m_exported.clear();
+	m_chat.clear();
+}
+
+
+void Federation::do_accept()
+{
+	m_acceptor.async_accept( m_socket,
+	[this]( std::error_code ec )
+	{
+		if ( m_stopped ) return;
+		if ( !ec )
+		{
+			start_link( std::make_shared<Link>( *this, std::move( m_socket ), "" ) );
+		}
+		else
+		{
+			std::cerr << "[ERROR] Could not accept federation link: " << ec << "\n";
+		}
+		do_accept();
+	} );
+}
+
+
+void Federation::connect( const std::string& peer )
+{
+	const auto colon = peer.rfind( ':' );
+	const auto host  = peer.substr( 0, colon );
+	const auto port  = peer.substr( colon + 1 );
+
+	m_resolver.async_resolve( host, port,
+	[this, peer]( asio::error_code ec, tcp::resolver::results_type results )
+	{
+		if ( m_stopped ) return;
+		if ( ec )
+		{
+			retry( peer );
+			return;
+		}
+		auto socket = std::make_shared<tcp::socket>( m_io_service );
+		asio::async_connect( *socket, results,
+		[this, peer, socket]( asio::error_code ec, const tcp::endpoint& )
+		{
+			if ( m_stopped ) return;
+			if ( ec )
+			{
+				retry( peer );
+				return;
+			}
+			start_link( std::make_shared<Link>( *this, std::move( *socket ), peer ) );
+		} );
+	} );
+}
+
+
+void Federation::retry( const std::string& peer )
+{
+	auto timer = std::make_shared<asio::steady_timer>( m_io_service, std::chrono::milliseconds( reconnect_interval_ms ) );
+	timer->async_wait(
+	[this, timer, peer]( asio::error_code ec )
+	{
+		if ( !ec && !m_stopped ) connect( peer );
+	} );
+}
+
+
+/*
+	Sends Hello and the full last exported state to a new link.
+*/
+void Federation::start_link( std::shared_ptr<Link> link )
+{
+	m_links.insert( link );
+
+	Writer w;
+	auto& p = w.record( Hello, 8 );
+	p.write_int( static_cast<unsigned int>( m_instance_id ) );
+	p.write_int( static_cast<unsigned int>( m_instance_id >> 32 ) );
+	const Replica none;
+	const std::vector<std::pair<unsigned int, std::string>> no_chat;
+	for ( const auto& it : m_exported )
+	{
+		write_delta( w, it.first, none, it.second, no_chat );
+	}
+	for ( const auto& frame : w.finish() )
+	{
+		link->send( frame );
+	}
+	link->start();
+}
+
+
+/*
+	Removes everything received through the link from the partitions.
+	Outgoing links are re-established.
+*/
+void Federation::close_link( Link& link )
+{
+	for ( const auto& it : link.rooms )
+	{
+		auto& lobby = m_partitions.lobby( it.first );
+		auto& ids   = link.players[it.first];
+		for ( const auto host : it.second )
+		{
+			lobby.remove_remote_room( ids[host] );
+		}
+	}
+	for ( const auto& it : link.players )
+	{
+		auto& lobby = m_partitions.lobby( it.first );
+		for ( const auto& id : it.second )
+		{
+			lobby.remove_remote_player( id.second );
+		}
+		m_partitions.close_if_empty( it.first );
+	}
+	link.rooms.clear();
+	link.players.clear();
+
+	if ( link.remote_instance ) std::cout << "Federation link closed: " << link.address() << std::endl;
+
+	if ( link.outgoing() && !link.no_retry() ) retry( link.peer() );
+	for ( auto it = m_links.begin(); it != m_links.end(); ++it )
+	{
+		if ( it->get() == &link )
+		{
+			m_links.erase( it );
+			break;
+		}
+	}
+}
+
+
+/*
+	Exports all local partitions, sends the differences to the last
+	exported state and the collected chat messages to every link.
+*/
+void Federation::do_batch()
+{
+	if ( !m_links.empty() )
+	{
+		std::set<std::string> keys;
+		for ( const auto& it : m_partitions.lobbies() ) keys.insert( it.first );
+		for ( const auto& it : m_exported )             keys.insert( it.first );
+
+		Writer w;
+		for ( const auto& key : keys )
+		{
+			Replica now;
+			const auto lobby = m_partitions.lobbies().find( key );
+			if ( m_partitions.lobbies().end() != lobby ) lobby->second->export_local( now );
+
+			write_delta( w, key, m_exported[key], now, m_chat[key] );
+			if ( now.players.empty() && now.rooms.empty() ) m_exported.erase( key );
+			else m_exported[key] = std::move( now );
+		}
+		for ( const auto& frame : w.finish() )
+		{
+			for ( const auto& link : m_links ) link->send( frame );
+		}
+	}
+	m_chat.clear();
+
+	m_batch_timer.expires_from_now( std::chrono::milliseconds( batch_interval_ms ) );
+	m_batch_timer.async_wait(
+	[this]( asio::error_code ec )
+	{
+		if ( !ec && !m_stopped ) do_batch();
+	} );
+}
+
+
+/*
+	Writes records which turn state "from" into state "to", plus chat.
+	Order matters for the receiver: players are known before rooms list
+	them, and rooms are removed before their players.
+*/
+void Federation::write_delta( Writer& w, const std::string& key, const Replica& from, const Replica& to,
+                              const std::vector<std::pair<unsigned int, std::string>>& chat ) const
+{
+	bool selected = false;
+	const auto select = [&]()
+	{
+		if ( !selected ) w.partition( key );
+		selected = true;
+	};
+
+	for ( const auto& it : to.players )
+	{
+		const auto old = from.players.find( it.first );
+		if ( from.players.end() != old && old->second == it.second ) continue;
+		select();
+		const auto& pl = it.second;
+		auto& p = w.record( PlayerUpsert, 10 + pl.name.size() + pl.props.size() );
+		p.write_int   ( it.first );
+		p.write_byte  ( pl.status );
+		p.write_byte  ( pl.announced_status );
+		p.write_string( pl.name,  Packet::Short );
+		p.write_string( pl.props, Packet::Short );
+	}
+	for ( const auto& msg : chat )
+	{
+		select();
+		auto& p = w.record( Chat, 6 + msg.second.size() );
+		p.write_int   ( msg.first );
+		p.write_string( msg.second, Packet::Short );
+	}
+	for ( const auto& it : from.rooms )
+	{
+		if ( to.rooms.count( it.first ) ) continue;
+		select();
+		w.record( RoomRemove, 4 ).write_int( it.first );
+	}
+	for ( const auto& it : to.rooms )
+	{
+		const auto old = from.rooms.find( it.first );
+		if ( from.rooms.end() != old && old->second == it.second ) continue;
+		select();
+		const auto& rm = it.second;
+		auto& p = w.record( RoomUpsert, 17 + rm.desc.size() + rm.info.size() + 4 * rm.players.size() );
+		p.write_int   ( it.first );
+		p.write_int   ( rm.magic );
+		p.write_byte  ( rm.hidden ? 1 : 0 );
+		p.write_string( rm.desc, Packet::Short );
+		p.write_string( rm.info, Packet::Short );
+		p.write_int   ( static_cast<unsigned int>( rm.players.size() ) );
+		for ( const auto id : rm.players ) p.write_int( id );
+	}
+	for ( const auto& it : from.players )
+	{
+		if ( to.players.count( it.first ) ) continue;
+		select();
+		w.record( PlayerRemove, 4 ).write_int( it.first );
+	}
+}
+
+
+/*
+	Applies all records of a received frame. Remote IDs are translated
+	through the link's ID map; records about unknown IDs are skipped.
+*/
+void Federation::apply( Link& link, Packet& p )
+{
+	const auto end = Packet::packet_header_size + p.size();
+	while ( p.seek_pos() < end )
+	{
+		const auto type = p.read_byte();
+
+		if ( Hello == type )
+		{
+			const unsigned long long lo = p.read_int();
+			const unsigned long long hi = p.read_int();
+			link.remote_instance = lo | hi << 32;
+			if ( m_instance_id == link.remote_instance )
+			{
+				std::cerr << "[WARNING] Federation peer " << link.address() << " is this server\n";
+				link.close( true );
+				return;
+			}
+			//two servers linking to each other: keep the link opened by the lower instance id
+			std::shared_ptr<Link> duplicate;
+			for ( const auto& other : m_links )
+			{
+				if ( other.get() != &link && other->remote_instance == link.remote_instance ) duplicate = other;
+			}
+			if ( duplicate )
+			{
+				const auto mine   = link.outgoing()       ? m_instance_id : link.remote_instance;
+				const auto theirs = duplicate->outgoing() ? m_instance_id : duplicate->remote_instance;
+				if ( mine >= theirs )
+				{
+					link.close( true );
+					return;
+				}
+				//the rest of this frame is the peer's full state, see start_link()
+				duplicate->close( true );
+			}
+			std::cout << "Federation link established: " << link.address() << std::endl;
+			continue;
+		}
+		if ( Partition == type )
+		{
+			link.partition = p.read_string( Packet::Short );
+			continue;
+		}
+		if ( link.partition.empty() || 0 == link.remote_instance )
+		{
+			std::cerr << "[ERROR] Invalid record from federation peer " << link.address() << "\n";
+			link.close();
+			return;
+		}
+
+		auto& lobby = m_partitions.lobby( link.partition );
+		auto& ids   = link.players[link.partition];
+		auto& rooms = link.rooms[link.partition];
+
+		if ( PlayerUpsert == type )
+		{
+			const auto id = p.read_int();
+			ReplicatedPlayer rp;
+			rp.status           = p.read_byte();
+			rp.announced_status = p.read_byte();
+			rp.name             = p.read_string( Packet::Short );
+			rp.props            = p.read_string( Packet::Short );
+
+			const auto it = ids.find( id );
+			if ( ids.end() == it ) ids.emplace( id, lobby.add_remote_player( rp ) );
+			else lobby.update_remote_player( it->second, rp );
+		}
+		else if ( PlayerRemove == type )
+		{
+			const auto it = ids.find( p.read_int() );
+			if ( ids.end() == it ) continue;
+			lobby.remove_remote_player( it->second );
+			ids.erase( it );
+		}
+		else if ( RoomUpsert == type )
+		{
+			const auto host = p.read_int();
+			ReplicatedRoom rr;
+			rr.magic  = p.read_int();
+			rr.hidden = 0 != p.read_byte();
+			rr.desc   = p.read_string( Packet::Short );
+			rr.info   = p.read_string( Packet::Short );
+			const auto count = std::min<unsigned int>( p.read_int(), ( end - std::min( end, p.seek_pos() ) ) / 4 );
+			for ( unsigned int i = 0; i < count; ++i )
+			{
+				const auto it = ids.find( p.read_int() );
+				if ( ids.end() != it ) rr.players.push_back( it->second );
+			}
+
+			const auto host_it = ids.find( host );
+			if ( ids.end() == host_it ) continue;
+			lobby.update_remote_room( host_it->second, rr );
+			rooms.insert( host );
+		}
+		else if ( RoomRemove == type )
+		{
+			const auto host = p.read_int();
+			const auto host_it = ids.find( host );
+			if ( ids.end() != host_it ) lobby.remove_remote_room( host_it->second );
+			rooms.erase( host );
+		}
+		else if ( Chat == type )
+		{
+			const auto id   = p.read_int();
+			const auto text = p.read_string( Packet::Short );
+			const auto it   = ids.find( id );
+			if ( ids.end() != it ) lobby.remote_chat( it->second, text );
+		}
+		else
+		{
+			std::cerr << "[ERROR] Unknown record from federation peer " << link.address() << "\n";
+			link.close();
+			return;
+		}
+	}
+}
@@ -0,0 +1,101 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "Options.hpp"
+#include "Packet.hpp"
+#include "Partitions.hpp"
+#include "Replication.hpp"
+
+using namespace asio::ip;
+
+/*
+	The Federation class links several servers (e.g. one per subnet) into
+	one lobby. Clients keep talking to their local server only.
+
+	Every batch_interval_ms each server compares the local Players and Rooms
+	of every partition with the state it sent last time and sends only the
+	differences to all linked servers, together with the public chat
+	messages of the interval, in one frame per link. A newly established
+	link gets the full state first.
+
+	Received Players and Rooms are added to the matching local partition
+	with local IDs (see Lobby::add_remote_player() etc.) and announced to
+	local Clients through the usual 0x1a6 / 0x1a7, 0x19d / 0x1a5 / 0x1a1
+	and 0x197 notifications. Remote Rooms can not be joined: game data is
+	only ever relayed by the server which hosts the Room.
+
+	Links are symmetric, a single link per pair of servers is enough.
+	Outgoing links (--peer) are re-established after connection loss.
+	When a link closes, all Players and Rooms received through it are
+	removed again.
+
+	Frames use the game packet header with the command code frame_cmd,
+	followed by a sequence of records (see Record enum).
+*/
+class Federation
+{
+public:
+	Federation( asio::io_service& io_service, Partitions& partitions, const Options& options );
+
+	//closes all links and stops listening (see Handoff class), start() undoes it
+	void stop();
+	void start();
+
+	enum { batch_interval_ms     = 100     };
+	enum { reconnect_interval_ms = 2000    };
+	enum { max_frame_size        = 0x100000 };//1 MiB
+	enum { frame_cmd             = 0xf00   };//not used by the game
+
+private:
+	class Link;
+
+	enum Record
+	{
+		Hello = 1,  //8 byte server instance id, first record on every link
+		Partition,  //string key, selects the partition for the following records
+		PlayerUpsert,
+		PlayerRemove,
+		RoomUpsert,
+		RoomRemove,
+		Chat
+	};
+
+	void do_accept();
+	void connect( const std::string& peer );
+	void retry( const std::string& peer );
+	void do_batch();
+
+	void start_link( std::shared_ptr<Link> link );
+	void close_link( Link& link );
+	void apply     ( Link& link, Packet& p );
+
+	//frames records into send buffers, see Federation.cpp
+	class Writer;
+	void write_delta( Writer& w, const std::string& key, const Replica& from, const Replica& to,
+	                  const std::vector<std::pair<unsigned int, std::string>>& chat ) const;
+
+	asio::io_service&  m_io_service;
+	Partitions&        m_partitions;
+	tcp::acceptor      m_acceptor;
+	tcp::socket        m_socket;
+	tcp::resolver      m_resolver;
+	asio::steady_timer m_batch_timer;
+	const Options      m_options;
+	bool               m_stopped;
+
+	std::set<std::shared_ptr<Link>> m_links;
+
+	//state of local partitions as sent in the last batch, key: partition
+	std::map<std::string, Replica> m_exported;
+	//public chat of local players since the last batch, key: partition
+	std::map<std::string, std::vector<std::pair<unsigned int, std::string>>> m_chat;
+
+	//random, used to detect duplicate links and links to ourselves
+	const unsigned long long m_instance_id;
+};
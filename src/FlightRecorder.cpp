@@ -0,0 +1,105 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include <ctime>
+#include <fstream>
+
+#include "FlightRecorder.hpp"
+
+FlightRecorder::Slot            FlightRecorder::s_ring[capacity];
+std::atomic<unsigned long long> FlightRecorder::s_next( 0 );
+
+
+/*
+	Claims the next ring slot and copies the header and up to body_bytes
+	of packet data into it. Called from the Session read and write paths.
+*/
+void FlightRecorder::record( Direction dir, unsigned int client_id, const unsigned char* frame, size_t frame_size )
+{
+	if ( header_size > frame_size ) return;
+
+	const auto n = s_next.fetch_add( 1, std::memory_order_relaxed );
+	auto& slot = s_ring[n & ( capacity - 1 )];
+
+	//mark slot as being written
+	slot.seq.store( 0, std::memory_order_relaxed );
+
+	slot.time       = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	                  std::chrono::steady_clock::now().time_since_epoch() ).count();
+	slot.client_id  = client_id;
+	slot.frame_size = static_cast<unsigned int>( frame_size );
+	slot.dir        = static_cast<unsigned char>( dir );
+	slot.body_size  = static_cast<unsigned char>( std::min<size_t>( frame_size - header_size, body_bytes ) );
+	std::memcpy( slot.header, frame, header_size );
+	std::memcpy( slot.body, frame + header_size, slot.body_size );
+
+	slot.seq.store( n + 1, std::memory_order_release );
+}
+
+
+/*
+	Writes all valid slots, oldest first, into a text file in the working
+	directory. Times are printed in milliseconds relative to the dump.
+*/
+bool FlightRecorder::dump( const std::string& reason, bool force )
+{
+	static auto last_dump = std::chrono::steady_clock::time_point();
+	const auto now = std::chrono::steady_clock::now();
+	if ( !force && last_dump.time_since_epoch().count() != 0 &&
+	     std::chrono::seconds( min_dump_interval ) > now - last_dump )
+	{
+		return false;
+	}
+	last_dump = now;
+
+	const auto wall = std::time( nullptr );
+	const std::string file_name = "flight-" + std::to_string( wall ) + ".log";
+	std::ofstream out( file_name );
+	if ( !out )
+	{
+		std::cerr << "[ERROR] Could not write flight recorder dump to " << file_name << "\n";
+		return false;
+	}
+
+	const auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( now.time_since_epoch() ).count();
+	const auto last   = s_next.load( std::memory_order_acquire );
+	const auto first  = ( capacity < last ) ? last - capacity : 0;
+
+	out << "# flight recorder dump: " << reason << "\n";
+	out << "# records " << first << " to " << last << "\n";
+	out << "# ms before dump, direction, client id, cmd, data size, id1, id2, first data bytes\n";
+
+	for ( auto n = first; n < last; ++n )
+	{
+		const auto& slot = s_ring[n & ( capacity - 1 )];
+		if ( slot.seq.load( std::memory_order_acquire ) != n + 1 ) continue;//overwritten or in progress
+
+		unsigned int   size = 0, id1 = 0, id2 = 0;
+		unsigned short cmd  = 0;
+		std::memcpy( &size, slot.header,      4 );
+		std::memcpy( &cmd,  slot.header + 4,  2 );
+		std::memcpy( &id1,  slot.header + 6,  4 );
+		std::memcpy( &id2,  slot.header + 10, 4 );
+
+		out << std::dec << std::setfill( ' ' ) << std::fixed << std::setprecision( 3 )
+		    << std::setw( 10 ) << ( now_ns - slot.time ) / 1e6
+		    << ( In == slot.dir ? "  in  " : "  out " )
+		    << std::setw( 5 ) << slot.client_id << "  "
+		    << std::hex << std::setw( 3 ) << std::setfill( '0' ) << cmd << "  "
+		    << std::dec << std::setfill( ' ' ) << std::setw( 7 ) << size << "  "
+		    << std::setw( 5 ) << id1 << "  " << std::setw( 5 ) << id2 << " ";
+		for ( unsigned int i = 0; i < slot.body_size; ++i )
+		{
+			out << ' ' << std::hex << std::setw( 2 ) << std::setfill( '0' ) << static_cast<unsigned int>( slot.body[i] );
+		}
+		out << '\n';
+	}
+
+	std::cerr << "[INFO] Flight recorder dumped to " << file_name << " (" << reason << ")\n";
+	return true;
+}
@@ -0,0 +1,56 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	The FlightRecorder keeps the most recent packet headers (plus the first
+	bytes of each body) in a fixed-size ring in memory. Recording is cheap
+	enough to stay enabled all the time; the ring is only written to disk
+	when something goes wrong:
+	  - on SIGUSR1 (see Server::do_await_signal())
+	  - on an ID lookup failure in Lobby::send()
+	  - on an unhandled exception in main()
+
+	Slots are claimed through an atomic counter, so recording never blocks.
+	Every slot carries the sequence number it was written with, which lets
+	dump() skip slots that are being overwritten at the same time.
+*/
+class FlightRecorder
+{
+public:
+	enum Direction { In, Out };
+
+	enum { capacity   = 8192 };//number of ring slots, must be a power of two
+	enum { body_bytes = 32   };//recorded bytes of packet data per slot
+	enum { header_size = 14  };
+
+	//frame points to the packet header, frame_size includes the header
+	static void record( Direction dir, unsigned int client_id, const unsigned char* frame, size_t frame_size );
+
+	//writes the ring to flight-<time>.log; unless forced, dumps are
+	//limited to one per min_dump_interval to keep failure storms off the disk
+	static bool dump( const std::string& reason, bool force = false );
+
+	enum { min_dump_interval = 10 };//seconds
+
+private:
+	struct Slot
+	{
+		std::atomic<unsigned long long> seq;//0: empty; otherwise record number + 1
+		long long     time;                 //steady clock, nanoseconds
+		unsigned int  client_id;
+		unsigned int  frame_size;
+		unsigned char dir;
+		unsigned char body_size;
+		unsigned char header[header_size];
+		unsigned char body[body_bytes];
+	};
+
+	static Slot                            s_ring[capacity];
+	static std::atomic<unsigned long long> s_next;
+};
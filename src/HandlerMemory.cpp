@@ -0,0 +1,40 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "HandlerMemory.hpp"
+
+static unsigned long long s_fallbacks = 0;
+
+
+void* HandlerMemory::allocate( size_t size )
+{
+	if ( !m_in_use && sizeof( m_block ) >= size )
+	{
+		m_in_use = true;
+		return &m_block;
+	}
+	++s_fallbacks;
+	return ::operator new( size );
+}
+
+
+void HandlerMemory::deallocate( void* p )
+{
+	if ( &m_block == p )
+	{
+		m_in_use = false;
+		return;
+	}
+	::operator delete( p );
+}
+
+
+void HandlerMemory::print( std::ostream& out )
+{
+	out << "handler allocations outside of session memory: " << s_fallbacks << "\n";
+}
@@ -0,0 +1,92 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	Memory for the state of one asynchronous operation at a time, for
+	Asio's associated allocator hook. A Session has one per chain of
+	operations (reading, writing, waiting for zero copy notifications).
+	Asio frees the operation state before it calls the handler, so the
+	next operation of the chain gets the same block again and the read
+	and write loops run without heap allocations.
+
+	Bigger requests, or a second one while the block is in use, fall
+	back to operator new and are counted (see print()).
+*/
+class HandlerMemory
+{
+public:
+	HandlerMemory() : m_in_use( false ) {};
+	HandlerMemory( const HandlerMemory& ) = delete;
+	HandlerMemory& operator =( const HandlerMemory& ) = delete;
+
+	void* allocate( size_t size );
+	void  deallocate( void* p );
+
+	//fallback allocations of all instances
+	static void print( std::ostream& out );
+
+	enum { block_size = 512 };
+
+private:
+	std::aligned_storage<block_size>::type m_block;
+	bool m_in_use;
+};
+
+
+//standard allocator interface to a HandlerMemory
+template <typename T>
+class HandlerAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit HandlerAllocator( HandlerMemory& memory ) : m_memory( &memory ) {};
+	template <typename U>
+	HandlerAllocator( const HandlerAllocator<U>& other ) : m_memory( other.m_memory ) {};
+
+	T* allocate( size_t n ) { return static_cast<T*>( m_memory->allocate( sizeof( T ) * n ) ); };
+	void deallocate( T* p, size_t ) { m_memory->deallocate( p ); };
+
+	bool operator ==( const HandlerAllocator& other ) const { return m_memory == other.m_memory; };
+	bool operator !=( const HandlerAllocator& other ) const { return m_memory != other.m_memory; };
+
+private:
+	template <typename> friend class HandlerAllocator;
+	HandlerMemory* m_memory;
+};
+
+
+//wraps a completion handler, Asio finds the allocator through get_allocator()
+template <typename Handler>
+class AllocatingHandler
+{
+public:
+	typedef HandlerAllocator<Handler> allocator_type;
+
+	AllocatingHandler( HandlerMemory& memory, Handler&& handler ) :
+		m_memory ( memory ),
+		m_handler( std::move( handler ) )
+	{};
+
+	allocator_type get_allocator() const { return allocator_type( m_memory ); };
+
+	template <typename... Args>
+	void operator ()( Args&&... args ) { m_handler( std::forward<Args>( args )... ); };
+
+private:
+	HandlerMemory& m_memory;
+	Handler        m_handler;
+};
+
+
+template <typename Handler>
+AllocatingHandler<typename std::decay<Handler>::type> make_handler( HandlerMemory& memory, Handler&& handler )
+{
+	return AllocatingHandler<typename std::decay<Handler>::type>( memory, std::forward<Handler>( handler ) );
+}
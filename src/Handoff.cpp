@@ -0,0 +1,214 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "Handoff.hpp"
+#include "Packet.hpp"
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+	A blocking call on the socket returns EAGAIN when the timeout set by
+	arm_timeout() expires, which fails the handoff like a lost connection.
+*/
+Handoff::Handoff( int fd, std::chrono::steady_clock::time_point deadline ) :
+	m_fd      ( fd ),
+	m_deadline( deadline )
+{
+	const int flags = ::fcntl( m_fd, F_GETFL );
+	if ( -1 != flags ) ::fcntl( m_fd, F_SETFL, flags & ~O_NONBLOCK );
+	arm_timeout( SO_RCVTIMEO );
+	arm_timeout( SO_SNDTIMEO );
+}
+
+
+bool Handoff::arm_timeout( int option )
+{
+	if ( std::chrono::steady_clock::time_point() == m_deadline ) return true;
+	using namespace std::chrono;
+	const auto left = duration_cast<microseconds>( m_deadline - steady_clock::now() ).count();
+	if ( 0 >= left ) return false;
+	timeval tv;
+	tv.tv_sec  = static_cast<time_t>( left / 1000000 );
+	tv.tv_usec = static_cast<suseconds_t>( left % 1000000 );
+	return 0 == ::setsockopt( m_fd, SOL_SOCKET, option, &tv, sizeof( tv ) );
+}
+
+
+int Handoff::connect( const std::string& path )
+{
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if ( sizeof( addr.sun_path ) <= path.size() ) return -1;
+	std::memcpy( addr.sun_path, path.c_str(), path.size() );
+
+	const int fd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( -1 == fd ) return -1;
+	if ( 0 != ::connect( fd, reinterpret_cast<sockaddr*>( &addr ), sizeof( addr ) ) )
+	{
+		::close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+
+void Handoff::remove_stale_socket( const std::string& path )
+{
+	struct stat st;
+	if ( 0 != ::lstat( path.c_str(), &st ) ) return;
+	if ( !S_ISSOCK( st.st_mode ) ) throw std::runtime_error( path + " exists and is not a socket" );
+	::unlink( path.c_str() );
+}
+
+
+/*
+	The descriptor is attached to the first sendmsg() call, the rest
+	of the frame follows with plain send() calls if necessary. Every
+	call may block only until the deadline.
+*/
+void Handoff::send( const Buffer& buf, size_t size, int fd )
+{
+	size_t sent = 0;
+	if ( -1 != fd )
+	{
+		iovec iov;
+		iov.iov_base = const_cast<unsigned char*>( buf.data() );
+		iov.iov_len  = size;
+
+		char control[CMSG_SPACE( sizeof( int ) )] = {};
+		msghdr msg = {};
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof( control );
+		cmsghdr* cmsg   = CMSG_FIRSTHDR( &msg );
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN( sizeof( int ) );
+		std::memcpy( CMSG_DATA( cmsg ), &fd, sizeof( int ) );
+
+		ssize_t n;
+		do
+		{
+			if ( !arm_timeout( SO_SNDTIMEO ) ) throw std::runtime_error( "handoff: deadline passed" );
+		}
+		while ( -1 == ( n = ::sendmsg( m_fd, &msg, MSG_NOSIGNAL ) ) && EINTR == errno );
+		if ( n <= 0 ) throw std::runtime_error( "handoff: sendmsg() failed" );
+		sent = static_cast<size_t>( n );
+	}
+	while ( sent < size )
+	{
+		if ( !arm_timeout( SO_SNDTIMEO ) ) throw std::runtime_error( "handoff: deadline passed" );
+		const auto n = ::send( m_fd, buf.data() + sent, size - sent, MSG_NOSIGNAL );
+		if ( -1 == n && EINTR == errno ) continue;
+		if ( n <= 0 ) throw std::runtime_error( "handoff: send() failed" );
+		sent += static_cast<size_t>( n );
+	}
+}
+
+
+void Handoff::send( Record record, unsigned int id1, int fd )
+{
+	Buffer buf( Packet::packet_header_size );
+	Packet p( buf, 0 );
+	p.seek_to_start();
+	p.write_header( record, id1, 0 );
+	send( buf, p.send_size(), fd );
+}
+
+
+/*
+	Reads the header with recvmsg() to pick up a descriptor, then
+	the body.
+*/
+void Handoff::receive( Buffer& buf, int& fd )
+{
+	fd = -1;
+	if ( buf.size() < Packet::packet_header_size ) buf.resize( Packet::packet_header_size );
+
+	size_t got = 0;
+	while ( got < Packet::packet_header_size )
+	{
+		iovec iov;
+		iov.iov_base = buf.data() + got;
+		iov.iov_len  = Packet::packet_header_size - got;
+
+		char control[CMSG_SPACE( sizeof( int ) )] = {};
+		msghdr msg = {};
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof( control );
+
+		const auto n = ::recvmsg( m_fd, &msg, 0 );
+		if ( -1 == n && EINTR == errno ) continue;
+		if ( n <= 0 ) throw std::runtime_error( "handoff: connection lost" );
+		got += static_cast<size_t>( n );
+
+		for ( cmsghdr* cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+		{
+			if ( SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type )
+			{
+				std::memcpy( &fd, CMSG_DATA( cmsg ), sizeof( int ) );
+			}
+		}
+	}
+
+	const Packet p( buf, 0 );
+	const size_t frame_size = Packet::packet_header_size + p.size();
+	if ( buf.size() < frame_size ) buf.resize( frame_size );
+	while ( got < frame_size )
+	{
+		const auto n = ::read( m_fd, buf.data() + got, frame_size - got );
+		if ( -1 == n && EINTR == errno ) continue;
+		if ( n <= 0 ) throw std::runtime_error( "handoff: connection lost" );
+		got += static_cast<size_t>( n );
+	}
+}
+
+
+void Handoff::send_ack()
+{
+	const char ack = 1;
+	while ( -1 == ::send( m_fd, &ack, 1, MSG_NOSIGNAL ) && EINTR == errno );
+}
+
+
+bool Handoff::receive_ack()
+{
+	char ack = 0;
+	ssize_t n;
+	do
+	{
+		if ( !arm_timeout( SO_RCVTIMEO ) ) return false;
+	}
+	while ( -1 == ( n = ::read( m_fd, &ack, 1 ) ) && EINTR == errno );
+	//-1 with EAGAIN: the deadline passed
+	return 1 == n && 1 == ack;
+}
+
+#else //no Unix domain sockets
+
+Handoff::Handoff( int fd, std::chrono::steady_clock::time_point deadline ) : m_fd( fd ), m_deadline( deadline ) {}
+int  Handoff::connect( const std::string& ) { return -1; }
+void Handoff::remove_stale_socket( const std::string& ) {}
+void Handoff::send( const Buffer&, size_t, int ) { throw std::runtime_error( "handoff: not supported" ); }
+void Handoff::send( Record, unsigned int, int )  { throw std::runtime_error( "handoff: not supported" ); }
+void Handoff::receive( Buffer&, int& )           { throw std::runtime_error( "handoff: not supported" ); }
+void Handoff::send_ack() {}
+bool Handoff::receive_ack() { return false; }
+
+#endif
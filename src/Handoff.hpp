@@ -0,0 +1,79 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	Hot restart: a running server hands its listening socket, all client
+	connections and the complete lobby state over to a new server process,
+	so the server binary can be replaced without ending running games.
+
+	Both processes are started with the same --handoff path. The running
+	server listens on this Unix socket. A new server connects to it on
+	startup and the running one then (see Server::hand_off()):
+	  1. stops accepting, closes federation links
+	  2. flushes coalesced updates, suspends every Session; cancelled reads
+	     and writes keep the partially read frame and send progress, big
+	     frames already being forwarded are received completely first
+	  3. sends the records below; socket descriptors travel as SCM_RIGHTS
+	  4. waits for the acknowledgement and exits, or resumes if none comes
+	Steps 2 to 4 together may take max_suspend_ms at most; a new process
+	which hangs instead of reading or acknowledging makes the running
+	server resume when the socket timeouts expire.
+
+	Records are frames with the game packet header and a Record command
+	code. Clients do not notice anything except the pause.
+
+	Only available where Asio supports Unix domain sockets.
+*/
+class Handoff
+{
+public:
+	enum Record
+	{
+		Listener = 0xf10,//fd: client acceptor
+		Counter,         //id1: last issued Client ID
+		Partition,       //Short string key, selects partition for the following records
+		PlayerState,     //id1: Player ID, see Lobby::save()
+		RoomState,       //id1: room host ID, see Lobby::save()
+		SessionState,    //id1: Client ID, fd: socket, see Session::hand_off()
+		Done
+	};
+
+	//longest pause before the running server gives up and resumes
+	enum { max_suspend_ms = 1000 };
+
+	//uses the connected Unix stream socket fd in blocking mode, does not own it;
+	//with a deadline, sending and receive_ack() fail once it has passed
+	explicit Handoff( int fd, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point() );
+
+	//returns the connected socket, or -1 if no server listens on path
+	static int connect( const std::string& path );
+	//removes a socket file left at path by a server which is gone; throws
+	//std::runtime_error if path names anything else, which is never removed
+	static void remove_stale_socket( const std::string& path );
+
+	//sends size bytes of buf (a complete frame), plus fd if not -1
+	void send( const Buffer& buf, size_t size, int fd = -1 );
+	//header only frame
+	void send( Record record, unsigned int id1 = 0, int fd = -1 );
+
+	//reads one frame into buf (resized as necessary), fd is -1 if none came
+	//with it; throws std::runtime_error on connection loss
+	void receive( Buffer& buf, int& fd );
+
+	void send_ack();
+	bool receive_ack();
+
+private:
+	//sets the socket option (SO_RCVTIMEO or SO_SNDTIMEO) to the time left
+	//until m_deadline; false if it has passed
+	bool arm_timeout( int option );
+
+	int m_fd;
+	const std::chrono::steady_clock::time_point m_deadline;//none if default
+};
@@ -0,0 +1,88 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include <unordered_map>
+
+#include "Interned.hpp"
+#include "Trace.hpp"
+
+struct Interned::Entry
+{
+	unsigned int refs = 0;
+	const std::string* str = nullptr;//key of the table element
+
+	Trace<Interned> t;
+};
+
+typedef std::unordered_map<std::string, Interned::Entry> Table;
+
+//constructed on first use, elements never move (node based container)
+static Table& table()
+{
+	static Table t;
+	return t;
+}
+
+
+/*
+	Looks the string up and counts the reference, adds it if necessary.
+	The empty string has no entry.
+*/
+static Interned::Entry* acquire( const std::string& s )
+{
+	if ( s.empty() ) return nullptr;
+	auto result = table().emplace( s, Interned::Entry() );
+	auto& entry = result.first->second;
+	if ( result.second )
+	{
+		entry.str = &result.first->first;
+		Trace<Interned>::add_bytes( s.size() );
+	}
+	++entry.refs;
+	return &entry;
+}
+
+
+Interned::Interned() :
+	m_entry( nullptr )
+{}
+
+
+Interned::Interned( const std::string& s ) :
+	m_entry( acquire( s ) )
+{}
+
+
+Interned::Interned( const Interned& other ) :
+	m_entry( other.m_entry )
+{
+	if ( m_entry ) ++m_entry->refs;
+}
+
+
+//the moved-from handle is left with the empty string
+Interned::Interned( Interned&& other ) :
+	m_entry( other.m_entry )
+{
+	other.m_entry = nullptr;
+}
+
+
+Interned::~Interned()
+{
+	if ( !m_entry || 0 != --m_entry->refs ) return;
+	Trace<Interned>::sub_bytes( m_entry->str->size() );
+	table().erase( table().find( *m_entry->str ) );
+}
+
+
+const std::string& Interned::str() const
+{
+	static const std::string empty;
+	return m_entry ? *m_entry->str : empty;
+}
@@ -0,0 +1,41 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	Handle to a string in the process wide interning table. Equal strings
+	share one table entry, so handles are pointer sized and copying one
+	only counts a reference. Entries are freed with the last handle. The
+	empty string needs no entry.
+
+	Used for strings which are the same for most Players and Rooms
+	(client versions, default properties, room info). The table is not
+	locked, handles must only be used on the event loop thread.
+*/
+class Interned
+{
+public:
+	Interned();//empty string
+	explicit Interned( const std::string& s );
+	Interned( const Interned& other );
+	Interned( Interned&& other );
+	~Interned();
+
+	Interned& operator =( Interned other ) { std::swap( m_entry, other.m_entry ); return *this; };
+
+	//borrowed view, valid as long as the handle
+	const std::string& str() const;
+
+	bool operator ==( const Interned& other ) const { return m_entry == other.m_entry; };
+	bool operator !=( const Interned& other ) const { return m_entry != other.m_entry; };
+
+	struct Entry;
+
+private:
+	Entry* m_entry;
+};
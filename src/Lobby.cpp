@@ -10,10 +10,16 @@
 #include <chrono>
 #endif
 
+#include "FlightRecorder.hpp"
 #include "Lobby.hpp"
 #include "Packet.hpp"
+#include "SendBuffer.hpp"
 #include "Session.hpp"
 
+static unsigned long long s_lookup_misses[Lobby::lookup_sites] = {};
+static unsigned long long s_props_answered  = 0;
+static unsigned long long s_props_forwarded = 0;
+
 /*
 	Assigns incremented ID to Client and stores pointer in map
 */
@@ -21,7 +27,32 @@ void Lobby::connect( std::shared_ptr<Client> client )
 {
 	const auto id = ++m_last_issued_id;
 	client->set_id( id );
-	m_clients.emplace( std::make_pair( id, client ) );
+	adopt( client );
+}
+
+
+/*
+	Stores pointer to a Client which already has an ID. Used by Partitions
+	to move a Client from the reception Lobby into its version partition,
+	and for Sessions taken over on hot restart, whose Player may be in a
+	running game.
+*/
+void Lobby::adopt( std::shared_ptr<Client> client )
+{
+	m_clients.emplace( std::make_pair( client->id(), client ) );
+	const auto it = m_players.find( client->id() );
+	if ( m_players.end() != it ) client->set_in_game( it->second->in_game() );
+}
+
+
+/*
+	Forgets a Client without any notifications. Must only be used for
+	Clients which have not logged in (no Player object).
+*/
+void Lobby::release( unsigned int client_id )
+{
+	assert( m_players.end() == m_players.find( client_id ) );
+	m_clients.erase( client_id );
 }
 
 
@@ -30,6 +61,16 @@ void Lobby::connect( std::shared_ptr<Client> client )
 	Sends notifications to others if necessary.
 */
 void Lobby::disconnect( std::shared_ptr<Client> client )
+{
+	detach( client );
+	disconnect( std::vector<std::shared_ptr<Client>>( 1, client ) );
+}
+
+
+/*
+	First step of a disconnect: the Client gets no more packets.
+*/
+void Lobby::detach( std::shared_ptr<Client> client )
 {
 	std::cout << "Client disconnected: " << std::setfill(' ') << std::setw(15)
 	          << std::right << client->address() << std::endl;
@@ -37,34 +78,642 @@ void Lobby::disconnect( std::shared_ptr<Client> client )
 	//first, delete session to prevent asio send errors
 	const auto id = client->id();
 	m_clients.erase( id );
+	m_status_updates.erase( id );
+	m_room_updates.erase( id );
+}
+
+
+/*
+	Second step: removes the Players of the detached Clients. Room hosts
+	leave first, so a room is torn down once for all of its leaving
+	players, and a host transition picks a new host among the Clients
+	still connected. The notifications are batched (see flush_batch()).
+*/
+void Lobby::disconnect( const std::vector<std::shared_ptr<Client>>& clients )
+{
+	m_batching = true;
+	for ( const bool hosts : { true, false } )
+	{
+		for ( const auto& client : clients )
+		{
+			const auto id = client->id();
+			const auto it = m_players.find( id );
+			//disconnect before login (no Player object) or not in a room
+			if ( m_players.end() == it || !it->second->room() ) continue;
+			if ( hosts != ( id == it->second->room()->host_id() ) ) continue;
+
+			//trick process_buf() into sending "leaves room" notifications
+			//this will also take care about room host transition
+			Packet p( client->buf(), id );
+			p.write_header( 0x1a0, id, 0 );
+			process_buf( client );
+		}
+	}
+
+	for ( const auto& client : clients )
+	{
+		//we needed the player object while processing the 0x1a0 "message" above
+		const auto id = client->id();
+		if ( 0 == m_players.erase( id ) ) continue;
+
+		/* 0x1a7 notification format
+		id1 = id of leaving player
+		id2 = 0
+		data: none
+		*/
+		Packet p( client->buf(), id );
+		p.write_header( 0x1a7, id, 0 );
+		send( p, LobbySubscribers );
+	}
+	m_batching = false;
+	flush_batch();
+}
+
+
+void Lobby::batch( const std::shared_ptr<Client>& client, const SendBuffer& buf, Client::Lane lane )
+{
+	auto& batched = m_batch[client->id()];
+	batched.client = client;
+	batched.lanes[lane].insert( batched.lanes[lane].end(), buf.data(), buf.data() + buf.size() );
+}
+
+
+/*
+	Every Client gets the packets collected for it in one buffer per lane.
+*/
+void Lobby::flush_batch()
+{
+	for ( const auto& it : m_batch )
+	{
+		const auto& batched = it.second;
+		for ( int lane = Client::GameLane; Client::lane_count > lane; ++lane )
+		{
+			const auto& data = batched.lanes[lane];
+			if ( data.empty() ) continue;
+			batched.client->queue_buf( SendBuffer::create( data.data(), data.size() ), static_cast<Client::Lane>( lane ) );
+		}
+	}
+	m_batch.clear();
+}
+
+
+/*
+	Copies the state of all local Players and Rooms for replication.
+*/
+void Lobby::export_local( Replica& replica ) const
+{
+	replica.players.clear();
+	replica.rooms.clear();
+	for ( const auto& it : m_players )
+	{
+		const auto& pl = it.second;
+		if ( pl->is_remote() ) continue;
+		replica.players.emplace( it.first, ReplicatedPlayer{ pl->name(), pl->props(), pl->status(), pl->announced_status() } );
+	}
+	for ( const auto& it : m_rooms )
+	{
+		const auto& rm = it.second;
+		if ( rm->is_remote() ) continue;
+		replica.rooms.emplace( it.first, ReplicatedRoom{ rm->description(), rm->info(), rm->magic(), rm->is_hidden(), rm->players() } );
+	}
+}
 
-	auto it = m_players.find( id );
 
-	//stop here if the disconnect happened before login (no Player object)
-	if ( m_players.end() == it ) return;
+/*
+	Creates a Player without Client and announces it through 0x1a6.
+	Returns the local ID of the new Player.
+*/
+unsigned int Lobby::add_remote_player( const ReplicatedPlayer& rp )
+{
+	const auto id = ++m_last_issued_id;
+	auto& player = m_players.emplace( id, std::make_unique<Player>( id, rp.name, "", "" ) ).first->second;
+	player->set_remote();
+	player->set_props( rp.props );
+	player->set_status( rp.status );
+	player->set_announced_status( rp.announced_status );
+
+	//see 0x1a6 notification format in 0x19a branch of process_buf()
+	Packet p( m_buf, id );
+	p.seek_to_start();
+	p.write_string( player->name() );
+	p.write_byte( 0 );
+	p.write_string( player->props() );
+	p.write_byte( player->status() );
+	p.write_header( 0x1a6, id, 0 );
+	send( p, LobbySubscribers );
+	return id;
+}
 
-	Packet p( client->buf(), id );
 
-	//check if we need to simulate a "leave room" message
-	if ( it->second->room() )
+/*
+	Updates a remote Player. Changes of the announced status are
+	broadcast as 0x1ac, everything else is picked up by room updates.
+*/
+void Lobby::update_remote_player( unsigned int id, const ReplicatedPlayer& rp )
+{
+	const auto it = m_players.find( id );
+	if ( m_players.end() == it || !it->second->is_remote() ) return;
+	auto& player = it->second;
+
+	player->set_props( rp.props );
+	player->set_status( rp.status );
+	if ( player->announced_status() != rp.announced_status )
 	{
-		//trick process_buf() into sending "leaves room" notifications
-		//this will also take care about room host transition
-		p.write_header( 0x1a0, id, 0 );
-		process_buf( client );
+		player->set_announced_status( rp.announced_status );
+		//see 0x1ac response format in 0x1ab branch of process_buf()
+		Packet p( m_buf, id );
+		p.seek_to_start();
+		p.write_byte( rp.announced_status );
+		p.write_header( 0x1ac, id, 0 );
+		send( p, LobbySubscribers );
 	}
+}
+
 
-	//we needed the player object while processing the 0x1a0 "message" above
-	m_players.erase( id );
+void Lobby::remove_remote_player( unsigned int id )
+{
+	const auto it = m_players.find( id );
+	if ( m_players.end() == it || !it->second->is_remote() ) return;
+	m_players.erase( it );
+	m_status_updates.erase( id );
 
-	/* 0x1a7 notification format
-	id1 = id of leaving player
-	id2 = 0
-	data: none
-	*/
+	Packet p( m_buf, id );
 	p.seek_to_start();
 	p.write_header( 0x1a7, id, 0 );
-	send( p, Everyone );
+	send( p, LobbySubscribers );
+}
+
+
+/*
+	Creates (0x19d) or updates (0x1a5) a remote Room. A remote game start
+	is announced through 0x1a3, which makes clients hide the room.
+*/
+void Lobby::update_remote_room( unsigned int host_id, const ReplicatedRoom& rr )
+{
+	auto it = m_rooms.find( host_id );
+	const bool created = ( m_rooms.end() == it );
+	if ( created )
+	{
+		it = m_rooms.emplace( host_id, std::make_unique<Room>( host_id, rr.desc, rr.magic ) ).first;
+		it->second->set_remote();
+	}
+	else if ( !it->second->is_remote() ) return;//should never happen
+
+	auto& room = it->second;
+	const bool started = rr.hidden && !room->is_hidden();
+	//show room as full (info status 3) so clients do not try to join
+	const auto bar = rr.info.find( '|' );
+	room->set_info( std::string::npos == bar ? rr.info : "3" + rr.info.substr( bar ) );
+	room->set_players( rr.players );
+	if ( started ) room->hide_from_lobby();
+
+	Packet p( m_buf, host_id );
+	if ( created )
+	{
+		//see 0x19d notification format in 0x19c branch of process_buf()
+		p.seek_to_start();
+		p.write_byte( 7 );
+		p.write_int( 8 );
+		p.write_string( room->description() );
+		p.write_string( room->info() );
+		p.write_int( room->magic() );
+		p.write_short( 0 );
+		p.write_header( 0x19d, host_id, 0 );
+		send( p, LobbySubscribers );
+	}
+
+	write_room_update( p, *room, room->description() );
+	send( p, LobbySubscribers );
+
+	if ( started )
+	{
+		//see 0x1a3 notification format in 0x1a2 branch of process_buf()
+		const auto& players = room->players();
+		p.seek_to_start();
+		p.write_int( static_cast<unsigned int>( players.size() ) );
+		for ( size_t i = players.size(); 0 < i; )
+		{
+			const auto p_id   = players[--i];
+			const auto player = find_player( p_id, RoomMember );
+			p.write_int( p_id );
+			p.write_byte( player ? player->status() : 0 );
+		}
+		p.write_header( 0x1a3, host_id, 0 );
+		send( p, LobbySubscribers );
+	}
+}
+
+
+/*
+	Removes a remote Room the same way a leaving local host does, by
+	kick-notifying all players in the room through 0x1a1.
+*/
+void Lobby::remove_remote_room( unsigned int host_id )
+{
+	const auto it = m_rooms.find( host_id );
+	if ( m_rooms.end() == it || !it->second->is_remote() ) return;
+	const auto players = it->second->players();
+	m_rooms.erase( it );
+	m_room_updates.erase( host_id );
+
+	//see 0x1a1 notification format in 0x1a0 branch of process_buf()
+	Packet p( m_buf, host_id );
+	p.seek_to_start();
+	p.write_byte( 1 );
+	p.write_int( static_cast<unsigned int>( players.size() ) );
+	for ( auto p_id : players )
+	{
+		p.write_int( p_id );
+		p.write_byte( 0x01 );
+	}
+	p.write_header( 0x1a1, host_id, 0 );
+	send( p, LobbySubscribers );
+}
+
+
+/*
+	Delivers a public chat message of a remote Player as 0x197.
+*/
+void Lobby::remote_chat( unsigned int id, const std::string& text )
+{
+	if ( m_players.end() == m_players.find( id ) ) return;
+
+	//see 0x197 notification format in 0x196 branch of process_buf()
+	Packet p( m_buf, id );
+	p.seek_to_start();
+	p.write_string( text );
+	p.write_header( 0x197, id, 0 );
+	send( p, LobbySubscribers );
+}
+
+
+/*
+	Prints one line per connected Client: ID, address, player name (if
+	logged in), send queue depth and queued bytes. Used to find Sessions
+	which pin send buffers because their peer stopped reading.
+*/
+void Lobby::print_clients( std::ostream& out ) const
+{
+	out << std::dec << std::setfill( ' ' ) << std::left
+	    << std::setw( 6 ) << "id" << std::setw( 16 ) << "address" << std::setw( 18 ) << "player"
+	    << std::right << std::setw( 8 ) << "queued" << std::setw( 12 ) << "bytes";
+	TcpMonitor::print_header( out );
+	out << '\n';
+	for ( const auto& it : m_clients )
+	{
+		const auto pl = m_players.find( it.first );
+		out << std::left << std::setw( 6 ) << it.first << std::setw( 16 ) << it.second->address()
+		    << std::setw( 18 ) << ( m_players.end() == pl ? "-" : pl->second->name() ) << std::right
+		    << std::setw( 8 ) << it.second->queue_depth() << std::setw( 12 ) << it.second->queued_bytes();
+		TcpMonitor::print( out, it.second->tcp_stats() );
+		out << '\n';
+	}
+	out << std::flush;
+}
+
+
+void Lobby::add_to( Census& census ) const
+{
+	census.clients += m_clients.size();
+	census.players += m_players.size();
+	census.rooms   += m_rooms.size();
+	for ( const auto& it : m_clients )
+	{
+		const auto bytes = it.second->queued_bytes();
+		census.queued_packets  += it.second->queue_depth();
+		census.queued_bytes    += bytes;
+		census.max_queued_bytes = std::max<unsigned long long>( census.max_queued_bytes, bytes );
+	}
+}
+
+
+static void print_lag( std::ostream& out, const Room& room, const std::function<std::string( unsigned int )>& name_of )
+{
+	out << "game data round trips in us:\n"
+	    << "  " << std::left << std::setw( 6 ) << "id" << std::setw( 18 ) << "player" << std::setw( 7 ) << ""
+	    << std::right << std::setw( 10 ) << "acks" << std::setw( 10 ) << "smoothed" << std::setw( 10 ) << "last"
+	    << std::setw( 10 ) << "max" << std::setw( 8 ) << "unacked" << std::setw( 10 ) << "unmatched" << '\n';
+	room.lag().print( out, room.host_id(), name_of );
+}
+
+
+void Lobby::print_relay_lag( std::ostream& out ) const
+{
+	const auto name_of = [this]( unsigned int id ) -> std::string
+	{
+		const auto it = m_players.find( id );
+		return m_players.end() == it ? "-" : it->second->name();
+	};
+	for ( const auto& it : m_rooms )
+	{
+		const auto& room = *it.second;
+		if ( room.lag().empty() ) continue;
+
+		out << "room of " << room.host_id() << ", ";
+		print_lag( out, room, name_of );
+	}
+	out << std::flush;
+}
+
+
+void Lobby::print_players( std::ostream& out ) const
+{
+	out << std::dec << std::setfill( ' ' ) << std::left
+	    << std::setw( 6 ) << "id" << std::setw( 18 ) << "player" << std::setw( 8 ) << "status"
+	    << "room\n";
+	for ( const auto& it : m_players )
+	{
+		const auto& player = *it.second;
+		out << std::setw( 6 ) << player.id() << std::setw( 18 ) << player.name()
+		    << std::hex << std::setw( 8 ) << static_cast<unsigned int>( player.status() ) << std::dec << std::setw( 8 );
+		if ( player.room() ) out << player.room()->host_id();
+		else                 out << "-";
+		out << ( player.is_remote() ? "remote" : "" ) << "\n";
+	}
+	out << std::right << std::flush;
+}
+
+
+//tabs separate name, password and build in room descriptions
+static std::string printable( std::string s )
+{
+	std::replace( s.begin(), s.end(), '\t', ' ' );
+	return s;
+}
+
+
+void Lobby::print_rooms( std::ostream& out ) const
+{
+	out << std::dec << std::setfill( ' ' ) << std::left
+	    << std::setw( 6 ) << "host" << std::setw( 14 ) << "info" << std::setw( 8 ) << "hidden"
+	    << std::setw( 8 ) << "remote" << std::setw( 24 ) << "members" << "description\n";
+	for ( const auto& it : m_rooms )
+	{
+		const auto& room = *it.second;
+		std::ostringstream members;
+		for ( const auto id : room.players() ) members << ( members.tellp() ? "," : "" ) << id;
+		out << std::setw( 6 ) << room.host_id() << std::setw( 14 ) << room.info()
+		    << std::setw( 8 ) << ( room.is_hidden() ? "yes" : "no" ) << std::setw( 8 ) << ( room.is_remote() ? "yes" : "no" )
+		    << std::setw( 24 ) << members.str() << printable( room.description() ) << "\n";
+	}
+	out << std::right << std::flush;
+}
+
+
+/*
+	Room fields, then every member with status and send queue, then the
+	game data round trips.
+*/
+bool Lobby::print_room( unsigned int host_id, std::ostream& out ) const
+{
+	const auto it = m_rooms.find( host_id );
+	if ( m_rooms.end() == it ) return false;
+	const auto& room = *it->second;
+
+	out << std::dec << std::setfill( ' ' )
+	    << "room of " << room.host_id() << "\n"
+	    << "description " << printable( room.description() ) << "\n"
+	    << "info        " << room.info() << "\n"
+	    << "magic       " << room.magic() << "\n"
+	    << "hidden      " << ( room.is_hidden() ? "yes" : "no" ) << "\n"
+	    << "remote      " << ( room.is_remote() ? "yes" : "no" ) << "\n"
+	    << std::left << std::setw( 6 ) << "id" << std::setw( 18 ) << "player" << std::setw( 8 ) << "status"
+	    << std::setw( 16 ) << "address" << std::right << std::setw( 8 ) << "queued" << std::setw( 12 ) << "bytes" << "\n";
+	for ( const auto id : room.players() )
+	{
+		const auto pl = m_players.find( id );
+		const auto cl = m_clients.find( id );
+		out << std::left << std::setw( 6 ) << id;
+		if ( m_players.end() == pl ) out << std::setw( 18 ) << "-" << std::setw( 8 ) << "-";
+		else out << std::setw( 18 ) << pl->second->name() << std::hex << std::setw( 8 ) << static_cast<unsigned int>( pl->second->status() ) << std::dec;
+		if ( m_clients.end() == cl ) out << std::setw( 16 ) << "-" << std::right << "\n";
+		else out << std::setw( 16 ) << cl->second->address() << std::right
+		         << std::setw( 8 ) << cl->second->queue_depth() << std::setw( 12 ) << cl->second->queued_bytes() << "\n";
+	}
+	if ( !room.lag().empty() )
+	{
+		print_lag( out, room, [this]( unsigned int id ) -> std::string
+		{
+			const auto pl = m_players.find( id );
+			return m_players.end() == pl ? "-" : pl->second->name();
+		} );
+	}
+	out << std::flush;
+	return true;
+}
+
+
+bool Lobby::kick( unsigned int client_id )
+{
+	const auto it = m_clients.find( client_id );
+	if ( m_clients.end() == it ) return false;
+	//the Client leaves m_clients while it closes
+	const auto client = it->second;
+	client->kick();
+	return true;
+}
+
+
+void Lobby::print_lookup_misses( std::ostream& out )
+{
+	const char* names[lookup_sites] =
+	{
+		"send to source", "send to id2", "send to room of", "send to room member",
+		"0x192 player info", "0x1ab status", "0x1ad version", "0x1b3 properties",
+		"0x19c create room", "0x19e room", "0x19e player", "0x1a0 leave room", "0x1a2 start game", "0x1aa room update",
+		"room member"
+	};
+	out << "ID lookup misses:";
+	unsigned long long total = 0;
+	for ( int site = 0; lookup_sites > site; ++site )
+	{
+		if ( !s_lookup_misses[site] ) continue;
+		out << ( total ? ", " : " " ) << names[site] << " " << s_lookup_misses[site];
+		total += s_lookup_misses[site];
+	}
+	out << ( total ? "\n" : " none\n" );
+}
+
+
+void Lobby::print_props_cache( std::ostream& out )
+{
+	out << "Room properties requests: " << s_props_answered << " answered by the server, "
+	    << s_props_forwarded << " forwarded to the host\n";
+}
+
+
+/*
+	Broadcasts pending coalesced updates, then suspends all Clients.
+*/
+void Lobby::suspend()
+{
+	flush_coalesced( true );
+	m_flush_timer.cancel();
+	m_flush_armed = false;
+	for ( const auto& it : m_clients )
+	{
+		it.second->suspend();
+	}
+}
+
+
+bool Lobby::suspended() const
+{
+	for ( const auto& it : m_clients )
+	{
+		if ( !it.second->suspended() ) return false;
+	}
+	return true;
+}
+
+
+void Lobby::resume()
+{
+	for ( const auto& it : m_clients )
+	{
+		it.second->resume();
+	}
+}
+
+
+/*
+	Sends one Handoff::PlayerState record per local Player, then one
+	Handoff::RoomState record per local Room. Remote Players and Rooms
+	are left to the Federation of the new process.
+
+	PlayerState:
+	id1 = Player ID
+	data:
+		2 len
+		^ string = name, ver1, ver2, props (each with 2 byte length)
+		1 byte = status
+		1 byte = announced status
+		5 times (see Player::Missed):
+			4 int = number of IDs
+			^ int = ID
+
+	RoomState:
+	id1 = room host ID
+	data:
+		2 len
+		^ string = description, info (each with 2 byte length)
+		4 int = magic
+		1 byte = hidden
+		4 int = number of players
+		^ int = player ID (host first)
+*/
+void Lobby::save( Handoff& handoff ) const
+{
+	Buffer buf;
+	for ( const auto& it : m_players )
+	{
+		const auto& pl = it.second;
+		if ( pl->is_remote() ) continue;
+		const auto& m = pl->missed();
+		const std::set<unsigned int>* sets[] = { &m.joined, &m.left, &m.status, &m.rooms_created, &m.rooms_updated };
+
+		size_t size = Packet::packet_header_size + 8 + pl->name().size() + pl->ver1().size()
+		              + pl->ver2().size() + pl->props().size() + 2;
+		for ( const auto s : sets ) size += 4 + 4 * s->size();
+		buf.assign( size, 0 );
+
+		Packet p( buf, it.first );
+		p.seek_to_start();
+		p.write_string( pl->name(),  Packet::Short );
+		p.write_string( pl->ver1(),  Packet::Short );
+		p.write_string( pl->ver2(),  Packet::Short );
+		p.write_string( pl->props(), Packet::Short );
+		p.write_byte( pl->status() );
+		p.write_byte( pl->announced_status() );
+		for ( const auto s : sets )
+		{
+			p.write_int( static_cast<unsigned int>( s->size() ) );
+			for ( const auto id : *s ) p.write_int( id );
+		}
+		p.write_header( Handoff::PlayerState, it.first, 0 );
+		handoff.send( buf, p.send_size() );
+	}
+
+	for ( const auto& it : m_rooms )
+	{
+		const auto& rm = it.second;
+		if ( rm->is_remote() ) continue;
+		buf.assign( Packet::packet_header_size + 13 + rm->description().size() + rm->info().size()
+		            + 4 * rm->players().size(), 0 );
+
+		Packet p( buf, it.first );
+		p.seek_to_start();
+		p.write_string( rm->description(), Packet::Short );
+		p.write_string( rm->info(),        Packet::Short );
+		p.write_int( rm->magic() );
+		p.write_byte( rm->is_hidden() ? 1 : 0 );
+		p.write_int( static_cast<unsigned int>( rm->players().size() ) );
+		for ( const auto id : rm->players() ) p.write_int( id );
+		p.write_header( Handoff::RoomState, it.first, 0 );
+		handoff.send( buf, p.send_size() );
+	}
+}
+
+
+/*
+	Sends one Handoff::SessionState record per Client, see Session::hand_off().
+*/
+void Lobby::save_clients( Handoff& handoff, const std::string& partition ) const
+{
+	for ( const auto& it : m_clients )
+	{
+		it.second->hand_off( handoff, partition );
+	}
+}
+
+
+/*
+	Recreates a Player or Room from a record sent by save(). Players
+	are linked to their Room when the Room record arrives, their status
+	is kept as it was.
+*/
+void Lobby::restore( Packet& p )
+{
+	const auto id = p.id1();
+	if ( Handoff::PlayerState == p.cmd() )
+	{
+		const auto name  = p.read_string( Packet::Short );
+		const auto ver1  = p.read_string( Packet::Short );
+		const auto ver2  = p.read_string( Packet::Short );
+		const auto props = p.read_string( Packet::Short );
+		auto& player = m_players.emplace( id, std::make_unique<Player>( id, name, ver1, ver2 ) ).first->second;
+		player->set_props( props );
+		player->set_status( p.read_byte() );
+		player->set_announced_status( p.read_byte() );
+
+		Player::Missed m;
+		std::set<unsigned int>* sets[] = { &m.joined, &m.left, &m.status, &m.rooms_created, &m.rooms_updated };
+		for ( const auto s : sets )
+		{
+			const auto count = p.read_int();
+			for ( unsigned int i = 0; i < count; ++i ) s->insert( p.read_int() );
+		}
+		player->set_missed( m );
+	}
+	else if ( Handoff::RoomState == p.cmd() )
+	{
+		const auto desc  = p.read_string( Packet::Short );
+		const auto info  = p.read_string( Packet::Short );
+		const auto magic = p.read_int();
+		auto& room = m_rooms.emplace( id, std::make_unique<Room>( id, desc, magic ) ).first->second;
+		room->set_info( info );
+		if ( p.read_byte() ) room->hide_from_lobby();
+
+		const auto count = p.read_int();
+		for ( unsigned int i = 0; i < count; ++i )
+		{
+			const auto it = m_players.find( p.read_int() );
+			if ( m_players.end() == it ) continue;
+			const auto status = it->second->status();
+			it->second->join_room( *room );
+			it->second->set_status( status );
+		}
+	}
 }
 
 
@@ -78,96 +727,473 @@ void Lobby::disconnect( std::shared_ptr<Client> client )
 	to know how many bytes to copy into the shared buffer, and we don't want
 	to copy around the whole Session buffer every time.
 */
-void Lobby::send( const Packet& p, SendTo target ) const
+void Lobby::send( const Packet& p, SendTo target )
 {
 	auto const send_size = p.send_size();
 	assert( 0 < send_size );
 	if ( 0 == send_size ) return;//should never happen
 
-	const auto src_id = p.source();
 	//the shared pointer will be passed by value and pushed into Session queues
 	//queue will be pop'ed after async_write() completes, ensuring buffer lifetime
-	const auto buf_ptr = std::make_shared<Buffer>( p.buf().begin(), p.buf().begin() + send_size );
+	send( p, SendBuffer::create( p.buf().data(), send_size ), target );
+}
+
+
+/*
+	Passes buf_ptr to the Clients targeted by the Packet, which only has
+	to provide the header values. Collects the Clients in targets if given.
+	Lobby notifications (LobbySubscribers) take the lobby lane of the
+	Session send queues, everything else the game lane.
+*/
+void Lobby::send( const Packet& p, const BufPtr& buf_ptr, SendTo target, std::vector<std::shared_ptr<Client>>* targets )
+{
+	const auto src_id = p.source();
+	const auto lane   = LobbySubscribers == target ? Client::LobbyLane : Client::GameLane;
+	const auto deliver = [this, &buf_ptr, lane, targets]( const std::shared_ptr<Client>& client )
+	{
+		if ( m_batching && !targets )
+		{
+			batch( client, *buf_ptr, lane );
+			return;
+		}
+		client->queue_buf( buf_ptr, lane );
+		if ( targets ) targets->push_back( client );
+	};
+	const auto deliver_to = [this, &deliver]( unsigned int id, LookupSite site )
+	{
+		const auto it = m_clients.find( id );
+		if ( m_clients.end() != it ) deliver( it->second );
+		else miss( site );
+	};
 
 	//find Client instances and pass buffer pointer according to desired target
-	try
+	if      ( target == Source )
+	{
+		deliver_to( src_id, SendSource );
+	}
+	else if ( target == Id2 )
 	{
-		if      ( target == Source )
+		deliver_to( p.id2(), SendId2 );
+	}
+	else if ( target == Everyone )
+	{
+		for ( auto client : m_clients )
 		{
-			m_clients.at( src_id )->queue_buf( buf_ptr );
+			deliver( client.second );
 		}
-		else if ( target == Id2 )
+	}
+	else if ( target == EveryoneButSource )
+	{
+		for ( auto client : m_clients )
 		{
-			m_clients.at( p.id2() )->queue_buf( buf_ptr );
+			if ( src_id == client.first ) continue;
+			deliver( client.second );
 		}
-		else if ( target == Everyone )
+	}
+	else if ( target == LobbySubscribers )
+	{
+		for ( auto client : m_clients )
 		{
-			for ( auto client : m_clients )
+			const auto it = m_players.find( client.first );
+			if ( m_players.end() != it && !is_subscribed( *it->second, p ) )
 			{
-				client.second->queue_buf( buf_ptr );
+				//remember the subject for catch_up()
+				it->second->miss( p.cmd(), p.id1() );
+				continue;
 			}
+			deliver( client.second );
+		}
+	}
+	else //target depends on Player <> Room link
+	{
+		const auto player = find_player( src_id, SendRoom );
+		if ( !player ) return;
+		const auto room = player->room();
+		assert( room );
+		if ( !room ) return;//should never happen
+
+		track_relay( *room, src_id, p.cmd() );
+
+		if      ( target == RoomHost )
+		{
+			deliver_to( room->host_id(), SendRoomTarget );
 		}
-		else if ( target == EveryoneButSource )
+		else if ( target == EveryoneInRoom )
 		{
-			for ( auto client : m_clients )
+			const auto players = room->players();
+			for ( const auto p_id : players )
 			{
-				if ( src_id == client.first ) continue;
-				client.second->queue_buf( buf_ptr );
+				deliver_to( p_id, SendRoomTarget );
 			}
 		}
-		else //target depends on Player <> Room link
+		else if ( target == EveryoneInRoomButSource )
 		{
-			const auto& room = m_players.at( src_id )->room();
-			assert( room );
-			if ( !room ) return;//should never happen
-
-			if      ( target == RoomHost )
+			const auto players = room->players();
+			for ( auto p_id : players )
 			{
-				const auto room_host_id = room->host_id();
-				m_clients.at( room_host_id )->queue_buf( buf_ptr );
+				if ( src_id == p_id ) continue;
+				deliver_to( p_id, SendRoomTarget );
 			}
-			else if ( target == EveryoneInRoom )
+		}
+		else if ( target == PropagateInRoom )
+		{
+			//game data forwarding depends on packet source
+			const auto room_host_id = room->host_id();
+			if ( src_id == room_host_id )
 			{
-				const auto players = room->players();
-				for ( const auto p_id : players )
+				//host -> everyone in the room
+				for ( auto p_id : room->players() )
 				{
-					m_clients.at( p_id )->queue_buf( buf_ptr );
+					if ( p_id == src_id ) continue;
+					deliver_to( p_id, SendRoomTarget );
 				}
 			}
-			else if ( target == EveryoneInRoomButSource )
+			else
 			{
-				const auto players = room->players();
-				for ( auto p_id : players )
-				{
-					if ( src_id == p_id ) continue;
-					m_clients.at( p_id )->queue_buf( buf_ptr );
-				}
+				//player -> room host
+				deliver_to( room_host_id, SendRoomTarget );
 			}
-			else if ( target == PropagateInRoom )
+		}
+	}
+}
+
+
+Player* Lobby::find_player( unsigned int id, LookupSite site ) const
+{
+	const auto it = m_players.find( id );
+	if ( m_players.end() != it ) return it->second.get();
+	miss( site );
+	return nullptr;
+}
+
+
+void Lobby::drop_room_props( unsigned int player_id )
+{
+	const auto it = m_players.find( player_id );
+	if ( m_players.end() != it && it->second->room() ) it->second->room()->drop_props();
+}
+
+
+void Lobby::track_relay( Room& room, unsigned int src_id, unsigned int cmd )
+{
+	if ( 0x4b0 != cmd && 0x456 != cmd && 0x460 != cmd ) return;
+
+	const auto now = RelayLag::Clock::now();
+	auto& lag = room.lag();
+	if ( 0x456 == cmd )
+	{
+		lag.acknowledged( src_id, now );
+	}
+	else if ( 0x460 == cmd )
+	{
+		lag.completed( src_id, now );
+	}
+	else if ( src_id == room.host_id() )
+	{
+		//see PropagateInRoom in send()
+		for ( const auto p_id : room.players() )
+		{
+			if ( p_id != src_id ) lag.sent( p_id, now );
+		}
+	}
+	else
+	{
+		lag.sent( room.host_id(), now );
+	}
+}
+
+
+void Lobby::miss( LookupSite site )
+{
+	++s_lookup_misses[site];
+	if ( RoomMember == site )
+	{
+		std::cerr << "[WARNING] Room member without Player\n";
+		FlightRecorder::dump( "room member without Player" );
+	}
+}
+
+
+/*
+	Only the header of the frame is in the Client buffer. 0x4b0 is
+	forwarded unchanged (see process_buf()), so the stream buffer takes
+	the place of the copy send() would make.
+*/
+bool Lobby::open_stream( std::shared_ptr<Client> client, const BufPtr& stream, std::vector<std::shared_ptr<Client>>& targets )
+{
+	const Packet p( client->buf(), client->id() );
+	const auto it = m_players.find( client->id() );
+	if ( 0x4b0 != p.cmd() || m_players.end() == it || !it->second->room() ) return false;
+
+	send( p, stream, PropagateInRoom, &targets );
+	return true;
+}
+
+
+/*
+	Lobby-only notifications (player status, joins and leaves, room list
+	changes, public chat) are of no use to players in a running game and
+	only compete with game data on their sockets. They are still sent if
+	the player is the source or the subject of the notification, or if the
+	subject is in the player's room.
+*/
+bool Lobby::is_subscribed( const Player& player, const Packet& p ) const
+{
+	if ( !player.in_game() ) return true;
+
+	const auto id = player.id();
+	if ( p.source() == id || p.id1() == id ) return true;
+
+	const auto room = player.room();
+	if ( !room ) return false;
+	const auto& players = room->players();
+	return players.end() != std::find( players.begin(), players.end(), p.id1() );
+}
+
+
+/*
+	Called when a player returns from a game to the lobby. Instead of
+	replaying every suppressed notification, sends one notification per
+	missed subject with its current state:
+	  0x1a7 for players which left, 0x1a6 for players which joined,
+	  0x1ac for status changes, 0x19d and 0x1a5 for new and updated rooms.
+	The packets are composed in the passed buffer.
+*/
+void Lobby::catch_up( Player& player, Buffer& buf )
+{
+	if ( !player.has_missed() ) return;
+	const auto missed = player.take_missed();
+
+	const auto id = player.id();
+	if ( m_clients.end() == m_clients.find( id ) ) return;//disconnecting
+
+	Packet p( buf, id );
+	for ( const auto l_id : missed.left )
+	{
+		p.seek_to_start();
+		p.write_header( 0x1a7, l_id, 0 );
+		send( p, Source );
+	}
+	for ( const auto j_id : missed.joined )
+	{
+		const auto it = m_players.find( j_id );
+		if ( m_players.end() == it ) continue;
+		const auto& pl = it->second;
+		//see 0x1a6 notification format in 0x19a branch of process_buf()
+		p.seek_to_start();
+		p.write_string( pl->name() );
+		p.write_byte( 0 );
+		p.write_string( pl->props() );
+		p.write_byte( pl->status() );
+		p.write_header( 0x1a6, j_id, 0 );
+		send( p, Source );
+	}
+	for ( const auto s_id : missed.status )
+	{
+		if ( missed.joined.count( s_id ) ) continue;//0x1a6 contains status
+		const auto it = m_players.find( s_id );
+		if ( m_players.end() == it ) continue;
+		p.seek_to_start();
+		p.write_byte( it->second->announced_status() );
+		p.write_header( 0x1ac, s_id, 0 );
+		send( p, Source );
+	}
+	for ( const auto r_id : missed.rooms_created )
+	{
+		const auto it = m_rooms.find( r_id );
+		if ( m_rooms.end() == it || it->second->is_hidden() ) continue;
+		const auto& rm = it->second;
+		//see 0x19d notification format in 0x19c branch of process_buf()
+		p.seek_to_start();
+		p.write_byte( 7 );
+		p.write_int( 8 );
+		p.write_string( rm->description() );
+		p.write_string( rm->info() );
+		p.write_int( rm->magic() );
+		p.write_short( 0 );
+		p.write_header( 0x19d, r_id, 0 );
+		send( p, Source );
+	}
+	std::set<unsigned int> updated( missed.rooms_updated );
+	updated.insert( missed.rooms_created.begin(), missed.rooms_created.end() );
+	for ( const auto r_id : updated )
+	{
+		const auto it = m_rooms.find( r_id );
+		if ( m_rooms.end() == it || it->second->is_hidden() ) continue;
+		write_room_update( p, *it->second, it->second->description() );
+		send( p, Source );
+	}
+}
+
+
+/*
+	Composes the 0x1a5 room update notification (see 0x1aa branch in
+	process_buf() for format) and calls Packet::write_header().
+*/
+void Lobby::write_room_update( Packet& p, const Room& room, const std::string& desc ) const
+{
+	const auto& players = room.players();
+	p.seek_to_start();
+	p.write_int( 8 );
+	p.write_string( desc );
+	p.write_string( room.info() );
+	p.write_int( 0 );
+	p.write_short( 0 );
+	p.write_int( static_cast<unsigned int>( players.size() ) );
+	//iterate backwards through players in room
+	for ( size_t i = players.size(); 0 < i; )
+	{
+		const auto p_id   = players[--i];
+		const auto player = find_player( p_id, RoomMember );
+		p.write_int( p_id );
+		p.write_byte( player ? player->status() : 0 );
+	}
+	p.write_header( 0x1a5, room.host_id(), 0 );
+}
+
+
+/*
+	Composes the 0x0c9 reply (see 0x0c9 branch in process_buf() for
+	format) of a remote Room from the replicated state. The hostname of
+	the host pc is not replicated and left empty; the info shows the
+	room as full (see update_remote_room()).
+*/
+void Lobby::write_remote_props( Packet& p, const Room& room, unsigned int client_id ) const
+{
+	const auto& players = room.players();
+	p.seek_to_start();
+	p.write_int( room.host_id() );
+	p.write_string( room.description(), Packet::Short );
+	p.write_string( room.info(), Packet::Short );
+	p.write_int( 8 );
+	p.write_int( room.magic() );
+	p.write_string( "", Packet::Short );
+	for ( int i = 0; 7 > i; ++i ) p.write_byte( 0 );
+	p.write_int( static_cast<unsigned int>( players.size() ) );
+	for ( auto p_id : players )
+	{
+		const auto player = find_player( p_id, RoomMember );
+		p.write_int( p_id );
+		p.write_short( 0 );
+		p.write_string( player ? player->name() : "", Packet::Short );
+		p.write_byte( 0 );
+		p.write_int( p_id );
+		p.write_byte( player ? player->status() : 0 );
+		for ( int i = 0; 6 > i; ++i ) p.write_byte( 0 );
+	}
+	p.write_header( 0x0c9, room.host_id(), client_id );
+}
+
+
+/*
+	Decides whether an update for key (room host ID or player ID) can be
+	broadcast now. If the last broadcast for the key is less than
+	m_coalesce_window ago, the update is marked pending instead, and will
+	be sent with the then current state by flush_coalesced().
+*/
+bool Lobby::coalesce( std::map<unsigned int, Coalesced>& updates, unsigned int key, const std::string& desc )
+{
+	if ( std::chrono::milliseconds::zero() == m_coalesce_window ) return true;
+	const auto now    = std::chrono::steady_clock::now();
+	const auto window = m_coalesce_window;
+
+	auto& u = updates[key];
+	if ( window <= now - u.last_sent )
+	{
+		u.last_sent = now;
+		u.pending   = false;
+		return true;
+	}
+
+	u.pending = true;
+	u.desc    = desc;
+	arm_flush_timer( u.last_sent + window );
+	return false;
+}
+
+
+void Lobby::arm_flush_timer( std::chrono::steady_clock::time_point when )
+{
+	if ( m_flush_armed ) return;
+	m_flush_armed = true;
+
+	m_flush_timer.expires_at( when );
+	std::weak_ptr<char> alive( m_alive );
+	m_flush_timer.async_wait(
+	[this, alive]( std::error_code ec )
+	{
+		if ( ec || alive.expired() ) return;
+		m_flush_armed = false;
+		flush_coalesced();
+	} );
+}
+
+
+/*
+	Broadcasts every pending update whose window has ended (or all of
+	them), using the current Room and Player state. Updates for rooms and
+	players which are gone by now are dropped. Re-arms the timer for the rest.
+*/
+void Lobby::flush_coalesced( bool all )
+{
+	const auto now    = std::chrono::steady_clock::now();
+	const auto window = m_coalesce_window;
+	auto next = std::chrono::steady_clock::time_point::max();
+
+	for ( auto it = m_room_updates.begin(); it != m_room_updates.end(); )
+	{
+		auto& u = it->second;
+		if ( !all && window > now - u.last_sent )
+		{
+			if ( u.pending ) next = std::min( next, u.last_sent + window );
+			++it;
+			continue;
+		}
+		if ( u.pending )
+		{
+			const auto room = m_rooms.find( it->first );
+			if ( m_rooms.end() != room )
 			{
-				//game data forwarding depends on packet source
-				const auto room_host_id = room->host_id();
-				if ( src_id == room_host_id )
-				{
-					//host -> everyone in the room
-					for ( auto p_id : room->players() )
-					{
-						if ( p_id == src_id ) continue;
-						m_clients.at( p_id )->queue_buf( buf_ptr );
-					}
-				}
-				else
-				{
-					//player -> room host
-					m_clients.at( room_host_id )->queue_buf( buf_ptr );
-				}
+				Packet p( m_buf, it->first );
+				write_room_update( p, *room->second, u.desc );
+				send( p, LobbySubscribers );
 			}
+			u.last_sent = now;
+			u.pending   = false;
+			++it;
 		}
+		else it = m_room_updates.erase( it );
 	}
-	catch ( std::out_of_range e )
+
+	for ( auto it = m_status_updates.begin(); it != m_status_updates.end(); )
 	{
-		std::cerr << "[WARNING] Lobby::send() -- ID map lookup failed\n";
+		auto& u = it->second;
+		if ( !all && window > now - u.last_sent )
+		{
+			if ( u.pending ) next = std::min( next, u.last_sent + window );
+			++it;
+			continue;
+		}
+		if ( u.pending )
+		{
+			const auto player = m_players.find( it->first );
+			if ( m_players.end() != player )
+			{
+				//see 0x1ac response format in 0x1ab branch of process_buf()
+				Packet p( m_buf, it->first );
+				p.seek_to_start();
+				p.write_byte( player->second->announced_status() );
+				p.write_header( 0x1ac, it->first, 0 );
+				send( p, LobbySubscribers );
+			}
+			u.last_sent = now;
+			u.pending   = false;
+			++it;
+		}
+		else it = m_status_updates.erase( it );
 	}
+
+	if ( std::chrono::steady_clock::time_point::max() != next ) arm_flush_timer( next );
 }
 
 
@@ -293,12 +1319,15 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			1 byte = 1
 			1 byte = 0 or 2
 		*/
+		//the status is part of the 0x0c9 reply
+		drop_room_props( c_id );
 		p.keep_whole_message();
 		send( p, RoomHost );
 	}
 	else if ( 0x065 == cmd /* player status (room)  */ )
 	{
 		//0x65 message format same as 0x64
+		drop_room_props( c_id );
 		p.keep_whole_message();
 		send( p, RoomHost );
 	}
@@ -318,7 +1347,8 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		*/
 		const auto info_id = p.read_int();
 
-		auto& player = m_players.at( info_id );
+		const auto player = find_player( info_id, PlayerInfo );
+		if ( !player ) return;
 
 		/* 0x193 response format
 		id1 = if of requested player
@@ -367,8 +1397,16 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		data:
 			1 status byte
 		*/
-		p.keep_whole_message( 0x1ac );
-		send( p, Everyone );
+		const auto player = find_player( c_id, PlayerStatus );
+		if ( !player ) return;
+		player->set_announced_status( p.read_byte() );
+		//the status is part of the 0x0c9 reply
+		if ( player->room() ) player->room()->drop_props();
+		if ( coalesce( m_status_updates, c_id ) )
+		{
+			p.keep_whole_message( 0x1ac );
+			send( p, LobbySubscribers );
+		}
 	}
 	else if ( 0x1ad == cmd /* version check         */ )
 	{
@@ -379,7 +1417,8 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			1 len
 			^ client version = %d.%d.%d
 		*/
-		auto& player = m_players.at( client->id() );
+		const auto player = find_player( client->id(), VersionCheck );
+		if ( !player ) return;
 
 		/* 0x1ae response format
 		id1 = 0
@@ -416,7 +1455,9 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		p.read_string();
 		const auto props = p.read_string();
 
-		m_players.at( c_id )->set_props( props );
+		const auto player = find_player( c_id, PlayerProps );
+		if ( !player ) return;
+		player->set_props( props );
 
 		/* 0x1b4 response format
 		id1 = player id
@@ -461,6 +1502,8 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			^ pc hostname
 			7 0h
 		*/
+		const auto hosted = m_rooms.find( c_id );
+		if ( m_rooms.end() != hosted ) hosted->second->drop_props();
 		p.keep_whole_message();
 		send( p, EveryoneButSource );
 	}
@@ -490,6 +1533,39 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 				1 player status byte -> transferred in 064 & 1ab to server
 				6 unknown bytes
 		*/
+
+		//a reply of the room host is kept for the next requests (see Room)
+		const auto hosted = m_rooms.find( c_id );
+		if ( m_rooms.end() != hosted && 4 < size && c_id == p.read_int() && c_id != id2 )
+		{
+			hosted->second->set_props( std::string( reinterpret_cast<const char*>( p.buf().data() ) + Packet::packet_header_size, size ) );
+		}
+		//a request to a room host is answered by the server if the reply is known
+		else
+		{
+			const auto asked = m_rooms.find( id2 );
+			//the host of a remote room cannot be asked, the request would go unanswered
+			if ( m_rooms.end() != asked && asked->second->is_remote() )
+			{
+				write_remote_props( p, *asked->second, c_id );
+				send( p, Source );
+				return;
+			}
+			if ( m_rooms.end() != asked && c_id != id2 )
+			{
+				const auto& props = asked->second->props();
+				if ( !props.empty() )
+				{
+					++s_props_answered;
+					p.seek_to_start();
+					p.write_bytes( props.data(), props.size() );
+					p.write_header( 0x0c9, id2, c_id );
+					send( p, Source );
+					return;
+				}
+				++s_props_forwarded;
+			}
+		}
 		p.keep_whole_message();
 		send( p, Id2 );
 	}
@@ -513,9 +1589,10 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		const auto info  = p.read_string();
 		const auto magic = p.read_int();
 
-		//create player object and get reference at one go
-		auto& room   = m_rooms.emplace( c_id, std::make_unique<Room>( c_id, desc ) ).first->second;
-		auto& player = m_players.at( c_id );
+		const auto player = find_player( c_id, CreateRoom );
+		if ( !player ) return;
+		//create room object and get reference at one go
+		auto& room = m_rooms.emplace( c_id, std::make_unique<Room>( c_id, desc, magic ) ).first->second;
 		//establish Player <> Room link for future lookups, add player id to Room::m_players
 		player->join_room( *room );
 
@@ -539,7 +1616,7 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		p.write_int( magic );
 		p.write_short( 0 );
 		p.write_header( 0x19d, id1, 0 );
-		send( p, Everyone );
+		send( p, LobbySubscribers );
 	}
 	else if ( 0x19e == cmd /* join room               */ )
 	{
@@ -551,8 +1628,41 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		*/
 		const int room_host_id = p.read_int();
 
-		auto& room   = m_rooms.at( room_host_id );
-		auto& player = m_players.at( id1 );
+		const auto it = m_rooms.find( room_host_id );
+		if ( m_rooms.end() == it )
+		{
+			miss( JoinRoomRoom );
+			return;
+		}
+		const auto& room  = it->second;
+		const auto player = find_player( id1, JoinRoomPlayer );
+		if ( !player ) return;
+		//rooms on other servers are listed, but game data is only relayed locally:
+		//the joining player gets what a host sends to turn away a player from
+		//a full room, the join (0x19f), then the kick (0x1b6, 0x1a1)
+		if ( room->is_remote() )
+		{
+			p.seek_to_start();
+			p.write_int( room_host_id );
+			p.write_byte( player->status() );
+			p.write_header( 0x19f, id1, 0 );
+			send( p, Source );
+
+			//see 0x1b5 branch for formats
+			p.seek_to_start();
+			p.write_int( id1 );
+			p.write_header( 0x1b6, room_host_id, 0 );
+			send( p, Source );
+
+			p.seek_to_start();
+			p.write_byte( 0 );
+			p.write_int( 1 );
+			p.write_int( id1 );
+			p.write_byte( 1 );
+			p.write_header( 0x1a1, id1, 0 );
+			send( p, Source );
+			return;
+		}
 		//establish Player <> Room link for future lookups, add player id to Room::m_players
 		player->join_room( *room );
 
@@ -576,8 +1686,9 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		id2 = 0
 		data: none
 		*/
-		auto& player = m_players.at( c_id );
-		auto  room   = player->room();
+		const auto player = find_player( c_id, LeaveRoom );
+		if ( !player ) return;
+		auto room = player->room();
 
 		//leaving host can trigger multiple 0x1a0 messages from players
 		//they MUST NOT be forwarded or responded
@@ -587,13 +1698,21 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		const auto players = room->players();
 		const auto status  = player->status();
 
+		//players staying in the game on host transfer; during a batched
+		//disconnect (see disconnect()) the detached ones are left out
+		std::vector<unsigned int> remaining;
+		for ( auto p_id : players )
+		{
+			if ( p_id != c_id && m_clients.count( p_id ) ) remaining.push_back( p_id );
+		}
+
 		//0x05 if still in room, 0x0f if during a game
 		const bool room_host_leaving    = ( 0x05 == status || 0x0f == status )     ? true : false;
 		//can be necessary even with 2 human players because of AI enemies
-		const bool host_transfer_needed = ( 0x0f == status && 1 < players.size() ) ? true : false;
+		const bool host_transfer_needed = ( 0x0f == status && !remaining.empty() ) ? true : false;
 
-		//grab the last player id in room in case we'll need a new host
-		const auto new_host_id = players.at( players.size() - 1 );
+		//grab the last remaining player id in case we'll need a new host
+		const auto new_host_id = remaining.empty() ? 0 : remaining.back();
 
 		/* 0x1a1 notification format
 		id1 = player id
@@ -611,10 +1730,17 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			p.write_int( static_cast<unsigned int>( players.size() ) );
 			for ( auto p_id : players )
 			{
-				auto& pl = m_players.at( p_id );
+				const auto pl = find_player( p_id, RoomMember );
+				p.write_int( p_id );
+				if ( !pl )
+				{
+					p.write_byte( 0 );
+					continue;
+				}
 				//remove Player <> Room link, erase player id from Room::m_players
 				pl->leave_room();
-				p.write_int( p_id );
+				const auto client = m_clients.find( p_id );
+				if ( m_clients.end() != client ) client->second->set_in_game( false );
 				p.write_byte( pl->status() );
 			}
 		}
@@ -622,6 +1748,7 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		{
 			//notify about this one player only
 			player->leave_room();
+			client->set_in_game( false );
 			p.write_byte( 0 );
 			p.write_int( 1 );
 			p.write_int( player->id() );
@@ -685,18 +1812,18 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			p.write_int( 0 );
 
 			p.write_string( "clients", Packet::Int );
-			p.write_string( std::to_string( players.size() - 1 ), Packet::Int );
+			p.write_string( std::to_string( remaining.size() ), Packet::Int );
 			p.write_int( 0 );
 
 			p.write_string( "clientslist", Packet::Int );
 			p.write_int ( 1 );
 			p.write_byte( 0 );
-			//list all player ids starting with the 2nd (1st was old host)
-			p.write_int( static_cast<unsigned int>( players.size() ) - 1 );
-			for ( auto it = players.begin() + 1; it != players.end(); ++it )
+			//list all remaining player ids (without the old host)
+			p.write_int( static_cast<unsigned int>( remaining.size() ) );
+			for ( auto p_id : remaining )
 			{
 				p.write_string( "*", Packet::Int );//character * seems irrelevant?
-				p.write_string( std::to_string( *it ), Packet::Int );
+				p.write_string( std::to_string( p_id ), Packet::Int );
 			}
 			p.write_int( 0 );
 			
@@ -713,12 +1840,11 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			data: none
 			*/
 			p.seek_to_start();
-			//start with the 2nd player to exclude old host
-			for ( auto it = players.begin() + 1; it != players.end(); ++it )
+			for ( auto p_id : remaining )
 			{
-				//send to all in room except the new host
-				if ( new_host_id == *it ) continue;
-				p.write_header( 0x1be, new_host_id, *it );
+				//send to all remaining except the new host
+				if ( new_host_id == p_id ) continue;
+				p.write_header( 0x1be, new_host_id, p_id );
 				send( p, Id2 );
 			}
 		}
@@ -728,6 +1854,18 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			//on host transfer the new host will recreate the room after recieving 0x1bd
 			//old room must be deleted in either case
 			m_rooms.erase( room_id );
+			//a pending 0x1a5 would describe a new room of the same host with the old desc
+			m_room_updates.erase( room_id );
+		}
+
+		//players returning to the lobby get the notifications they missed
+		//on host transfer the others stay in the game, only the leaver returns
+		for ( auto p_id : players )
+		{
+			if ( host_transfer_needed && p_id != c_id ) continue;
+			auto it = m_players.find( p_id );
+			if ( m_players.end() == it || it->second->in_game() ) continue;
+			catch_up( *it->second, client->buf() );
 		}
 	}
 	else if ( 0x1a2 == cmd /* start game              */ )
@@ -740,7 +1878,9 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 				4 int = player id
 				1 status byte
 		*/
-		const auto& room = m_players.at( c_id )->room();
+		const auto host = find_player( c_id, StartGame );
+		if ( !host ) return;
+		const auto room = host->room();
 		if ( !room ) return;//should never happen
 
 		//remember to not show this room to newcomers through 0x19b
@@ -760,14 +1900,21 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		//iterate backwards through players in room
 		for ( size_t i = players.size(); 0 < i; )
 		{
-			const auto p_id = players[--i];
-			auto& player    = m_players.at( p_id );
+			const auto p_id   = players[--i];
+			const auto player = find_player( p_id, RoomMember );
+			p.write_int( p_id );
+			if ( !player )
+			{
+				p.write_byte( 0 );
+				continue;
+			}
 
 			//0x1a2 comes from the host, set status accordingly
 			if ( p_id == c_id ) player->set_status( 0x0f );//host
 			else player->set_status( 0x0b );//normal player
+			const auto client = m_clients.find( p_id );
+			if ( m_clients.end() != client ) client->second->set_in_game( true );
 
-			p.write_int( p_id );
 			p.write_byte( player->status() );
 		}
 		p.write_header( 0x1a3, id1, 0 );
@@ -788,11 +1935,14 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		const std::string desc = p.read_string();
 		const std::string info = p.read_string();
 
-		auto room    = m_players.at( c_id )->room();
+		const auto host = find_player( c_id, RoomUpdate );
+		if ( !host ) return;
+		auto room = host->room();
 		if ( !room ) return;//should never happen
-		auto players = room->players();
 		
 		room->set_info( info );
+		//the description may have changed as well
+		room->drop_props();
 
 		/* 0x1a5 notification format
 		id1 = room host id
@@ -809,22 +1959,11 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 				4 int = player id
 				1 role = { 3, 7 } (3: normal, 7: room host)
 		*/
-		p.seek_to_start();
-		p.write_int( 8 );
-		p.write_string( desc );
-		p.write_string( info );
-		p.write_int( 0 );
-		p.write_short( 0 );
-		p.write_int( static_cast<unsigned int>( players.size() ) );
-		//iterate backwards through players in room
-		for ( size_t i = players.size(); 0 < i; )
+		if ( coalesce( m_room_updates, room->host_id(), desc ) )
 		{
-			const int p_id = players[--i];
-			p.write_int( p_id );
-			p.write_byte( m_players.at( p_id )->status() );
+			write_room_update( p, *room, desc );
+			send( p, LobbySubscribers );
 		}
-		p.write_header( 0x1a5, id1, 0 );
-		send( p, Everyone );
 	}
 	else if ( 0x1af == cmd /* player leaves game      */ )
 	{
@@ -889,6 +2028,7 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 					or just %d|%d|%d (nation,team,flag) for short player settings
 				4 int = 0 (separator)
 		*/
+		drop_room_props( c_id );
 		p.keep_whole_message( 0x1bc );
 		send( p, EveryoneInRoom );
 	}
@@ -923,13 +2063,15 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 			1 len
 			^ text message
 		*/
+		const auto text = p.read_string();
 		p.keep_whole_message( 0x197 );
 
 		//target depends on id constellation in header
 		if ( 0 == id2 )
 		{
 			//public message
-			send( p, Everyone );
+			send( p, LobbySubscribers );
+			if ( m_chat_listener ) m_chat_listener( c_id, text );
 		}
 		else if ( id1 == id2 )
 		{
@@ -940,7 +2082,8 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		{
 			//private message
 			send( p, Source );
-			send( p, Id2 );
+			//players on other servers have no Client to send to
+			if ( m_clients.end() != m_clients.find( id2 ) ) send( p, Id2 );
 		}
 	}
 
@@ -1175,7 +2318,7 @@ void Lobby::process_buf( std::shared_ptr<Client> client )
 		p.write_string( player->props() );
 		p.write_byte( player->status() );
 		p.write_header( 0x1a6, c_id, 0 );
-		send( p, Everyone );
+		send( p, LobbySubscribers );
 	}
 	
 #ifndef NDEBUG //print packets with unknown command codes
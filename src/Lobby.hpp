@@ -8,37 +8,213 @@
 #include "Precompiled.hpp"
 
 #include "Client.hpp"
+#include "Handoff.hpp"
 #include "Packet.hpp"
 #include "Player.hpp"
+#include "Replication.hpp"
 #include "Room.hpp"
 
 /*
 	The Lobby class keeps references to all Rooms and Players and controls
 	all network communication between Clients. It also issues Client IDs and
 	state changes in all Room and Player instances.
+
+	Every Lobby is one independent partition (see Partitions class). The ID
+	counter is shared between all partitions to keep Client IDs unique.
+
+	Room updates (0x1aa -> 0x1a5) and status updates (0x1ab -> 0x1ac) are
+	coalesced: per room and per player at most one broadcast is sent within
+	the coalescing window (--coalesce-ms). Updates arriving inside the
+	window only replace the pending state, which is broadcast when the
+	window ends. All other messages, and all updates with a window of 0,
+	bypass this stage.
 */
 class Lobby
 {
 public:
-	Lobby() : m_last_issued_id( 0 ) {};
+	Lobby( asio::io_service& io_service, unsigned int& last_issued_id, unsigned int coalesce_ms ) :
+		m_last_issued_id( last_issued_id ),
+		m_coalesce_window( coalesce_ms ),
+		m_buf           ( scratch_buffer_size ),
+		m_flush_timer   ( io_service ),
+		m_flush_armed   ( false ),
+		m_batching      ( false ),
+		m_alive         ( std::make_shared<char>() )
+	{};
 
 	void connect    ( std::shared_ptr<Client> client );
 	void disconnect ( std::shared_ptr<Client> client );
 	void process_buf( std::shared_ptr<Client> client );
 
+	/*
+		Disconnects in two steps, so that many failing at once (a switch
+		reboots) are handled as a batch: detach() removes the Client from
+		all recipient lists right away, disconnect() later removes the
+		Players of all Clients detached in the meantime and notifies the
+		remaining Clients once.
+	*/
+	void detach    ( std::shared_ptr<Client> client );
+	void disconnect( const std::vector<std::shared_ptr<Client>>& clients );
+
+	//cut-through forwarding of big 0x4b0 frames (see Session::open_stream()):
+	//queues the stream buffer like process_buf() would queue the complete
+	//frame, collects the recipients; false if the frame has to be processed
+	bool open_stream( std::shared_ptr<Client> client, const BufPtr& stream, std::vector<std::shared_ptr<Client>>& targets );
+
+	//move a Client which has not logged in yet between partitions
+	void adopt  ( std::shared_ptr<Client> client );
+	void release( unsigned int client_id );
+
+	//true if no Clients, Players or Rooms are left
+	bool empty() const { return m_clients.empty() && m_players.empty() && m_rooms.empty(); };
+
+	//prints send queue state and TCP statistics of every connected Client
+	void print_clients( std::ostream& out ) const;
+	//prints game data round trips of every room, see RelayLag class
+	void print_relay_lag( std::ostream& out ) const;
+
+	//admin console views, see AdminConsole class; print_room() is false
+	//and kick() does nothing if there is no such room or Client
+	void print_players( std::ostream& out ) const;
+	void print_rooms  ( std::ostream& out ) const;
+	bool print_room   ( unsigned int host_id, std::ostream& out ) const;
+	bool kick         ( unsigned int client_id );
+
+	//totals for the statistics segment, see StatsSegment
+	struct Census
+	{
+		unsigned long long clients          = 0;
+		unsigned long long players          = 0;
+		unsigned long long rooms            = 0;
+		unsigned long long queued_packets   = 0;
+		unsigned long long queued_bytes     = 0;
+		unsigned long long max_queued_bytes = 0;
+	};
+	void add_to( Census& census ) const;
+
+	/*
+		ID lookups in process_buf() and send() do not throw: a Client can
+		disconnect while packets from or to it are still in flight (a host
+		leaves while players still send 0x1a0). A miss drops the packet or
+		skips the target and is counted per site. Misses of RoomMember
+		mean inconsistent state and also trigger a flight recorder dump.
+	*/
+	enum LookupSite
+	{
+		SendSource, SendId2, SendRoom, SendRoomTarget,
+		PlayerInfo, PlayerStatus, VersionCheck, PlayerProps,
+		CreateRoom, JoinRoomRoom, JoinRoomPlayer, LeaveRoom, StartGame, RoomUpdate,
+		RoomMember,
+		lookup_sites
+	};
+	//prints the ID lookup misses of all partitions
+	static void print_lookup_misses( std::ostream& out );
+	//prints how many 0x0c9 requests were answered from Room::props()
+	static void print_props_cache( std::ostream& out );
+
+	/*
+		Hot restart, see Handoff class. suspend() broadcasts all pending
+		coalesced updates first. save() sends the Player and Room records,
+		restore() reads them in the new process.
+	*/
+	void suspend();
+	bool suspended() const;
+	void resume();
+	void save( Handoff& handoff ) const;
+	void save_clients( Handoff& handoff, const std::string& partition ) const;
+	void restore( Packet& p );
+
+	/*
+		Replication between servers, see Federation class. Remote Players
+		and Rooms get local IDs and are presented to local Clients like
+		local ones, but remote Rooms can not be joined.
+	*/
+	void export_local( Replica& replica ) const;
+	unsigned int add_remote_player( const ReplicatedPlayer& rp );
+	void      update_remote_player( unsigned int id, const ReplicatedPlayer& rp );
+	void      remove_remote_player( unsigned int id );
+	//creates or updates the room, rr.players must contain local IDs
+	void        update_remote_room( unsigned int host_id, const ReplicatedRoom& rr );
+	void        remove_remote_room( unsigned int host_id );
+	void               remote_chat( unsigned int id, const std::string& text );
+
+	//called for every public chat message of a local player
+	void set_chat_listener( std::function<void( unsigned int, const std::string& )> listener )
+	{ m_chat_listener = listener; };
+
 private:
 	enum SendTo
 	{
 		Source, Id2, Everyone, EveryoneButSource,
 		RoomHost, EveryoneInRoom, EveryoneInRoomButSource,
-		PropagateInRoom //used for game data, see Lobby::send() for details
+		PropagateInRoom,//used for game data, see Lobby::send() for details
+		LobbySubscribers//lobby-only notifications, see Lobby::is_subscribed(), Client::Lane
+	};
+	void send( const Packet& p, SendTo target );
+	void send( const Packet& p, const BufPtr& buf_ptr, SendTo target, std::vector<std::shared_ptr<Client>>* targets = nullptr );
+
+	Player* find_player( unsigned int id, LookupSite site ) const;
+	static void miss( LookupSite site );
+
+	//feeds game data and its acknowledgements relayed in room to its RelayLag
+	static void track_relay( Room& room, unsigned int src_id, unsigned int cmd );
+	//the cached 0x0c9 reply of the player's room is outdated, see Room
+	void drop_room_props( unsigned int player_id );
+
+	//false if the notification is deferred for the player (in a running game)
+	bool is_subscribed( const Player& player, const Packet& p ) const;
+	//sends what the player missed while in a game
+	void catch_up( Player& player, Buffer& buf );
+	//while m_batching, send() collects the packets per recipient and lane,
+	//flush_batch() queues them as one buffer each
+	void batch( const std::shared_ptr<Client>& client, const SendBuffer& buf, Client::Lane lane );
+	void flush_batch();
+
+	//composes 0x1a5 notification for the room
+	void write_room_update( Packet& p, const Room& room, const std::string& desc ) const;
+	//0x0c9 reply for a remote Room, which has no host to ask
+	void write_remote_props( Packet& p, const Room& room, unsigned int client_id ) const;
+
+	struct Coalesced
+	{
+		std::chrono::steady_clock::time_point last_sent;
+		bool        pending = false;
+		std::string desc;//room description of pending 0x1a5
 	};
-	void send( const Packet& p, SendTo target ) const;
+	//true if the update can be broadcast right away, otherwise it is kept pending
+	bool coalesce( std::map<unsigned int, Coalesced>& updates, unsigned int key, const std::string& desc = "" );
+	void arm_flush_timer( std::chrono::steady_clock::time_point when );
+	void flush_coalesced( bool all = false );
 
 	std::map<unsigned int, std::shared_ptr<Client>> m_clients;//key: Client ID
 	std::map<unsigned int, std::unique_ptr<Player>> m_players;//key: Client ID
 	std::map<unsigned int, std::unique_ptr<Room>>   m_rooms;  //key: room host Client ID
 
-	//increment IDs independent of current map size
-	unsigned int m_last_issued_id;
+	//increment IDs independent of current map size, shared between partitions
+	unsigned int& m_last_issued_id;
+
+	//minimum interval between two broadcasts of the same room or player state
+	const std::chrono::milliseconds m_coalesce_window;
+
+	//for packets composed without a Client buffer (coalesced updates)
+	enum { scratch_buffer_size = 0x10000 };
+	Buffer m_buf;
+
+	std::map<unsigned int, Coalesced> m_room_updates;  //key: room host Client ID
+	std::map<unsigned int, Coalesced> m_status_updates;//key: Client ID
+	asio::steady_timer m_flush_timer;
+	bool               m_flush_armed;
+
+	struct Batched
+	{
+		std::shared_ptr<Client> client;
+		Buffer lanes[Client::lane_count];
+	};
+	std::map<unsigned int, Batched> m_batch;//key: Client ID
+	bool                            m_batching;
+
+	//timer handlers hold a weak reference, the Lobby can be closed any time
+	std::shared_ptr<char> m_alive;
+
+	std::function<void( unsigned int, const std::string& )> m_chat_listener;
 };
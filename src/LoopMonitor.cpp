@@ -0,0 +1,164 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include <ctime>
+
+#include "LoopMonitor.hpp"
+
+//scheduling delay of the probes, see LoopMonitor::probe()
+static unsigned long long s_probes = 0;
+static unsigned long long s_lag_buckets[LoopMonitor::lag_buckets] = {};
+static long long          s_lag_max = 0;//us
+
+//busy ratio of the last complete window and the highest one, per mille
+static int s_busy_last = -1;
+static int s_busy_max  = -1;
+
+//stalls by command code, 0: other
+struct Stalls
+{
+	unsigned long long count;
+	long long          max_ms;
+};
+static std::map<unsigned int, Stalls> s_stalls;
+//a Handler reported a stall since the last probe
+static bool s_attributed = false;
+static std::chrono::steady_clock::time_point s_last_warning;
+
+//CPU time of the event loop thread, -1 where unavailable
+static long long thread_cpu_ns()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	timespec ts;
+	if ( 0 == clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) ) return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+	return -1;
+}
+
+
+LoopMonitor::LoopMonitor( asio::io_service& io_service ) :
+	m_timer        ( io_service ),
+	m_expiry       ( std::chrono::steady_clock::now() ),
+	m_window_probes( 0 ),
+	m_window_start ( m_expiry ),
+	m_window_cpu_ns( thread_cpu_ns() )
+{
+	arm();
+}
+
+
+void LoopMonitor::arm()
+{
+	m_expiry += std::chrono::milliseconds( probe_ms );
+	m_timer.expires_at( m_expiry );
+	m_timer.async_wait(
+	[this]( asio::error_code ec )
+	{
+		if ( !ec ) probe();
+	} );
+}
+
+
+/*
+	The lag is measured against the planned expiry. After a long stall
+	the missed probes are skipped instead of running back to back.
+*/
+void LoopMonitor::probe()
+{
+	using namespace std::chrono;
+	const auto now = steady_clock::now();
+	const long long lag_us = duration_cast<microseconds>( now - m_expiry ).count();
+
+	++s_probes;
+	unsigned int bucket = 0;
+	while ( lag_buckets - 1 > bucket && ( 1000LL << bucket ) <= lag_us ) ++bucket;
+	++s_lag_buckets[bucket];
+	s_lag_max = std::max( s_lag_max, lag_us );
+
+	if ( stall_ms * 1000LL <= lag_us && !s_attributed ) stall( 0, lag_us / 1000 );
+	s_attributed = false;
+
+	if ( window_probes <= ++m_window_probes )
+	{
+		const long long cpu_ns  = thread_cpu_ns();
+		const long long wall_ns = duration_cast<nanoseconds>( now - m_window_start ).count();
+		if ( 0 <= cpu_ns && 0 <= m_window_cpu_ns && 0 < wall_ns )
+		{
+			s_busy_last = static_cast<int>( std::min( 1000LL, ( cpu_ns - m_window_cpu_ns ) * 1000 / wall_ns ) );
+			s_busy_max  = std::max( s_busy_max, s_busy_last );
+		}
+		m_window_probes = 0;
+		m_window_start  = now;
+		m_window_cpu_ns = cpu_ns;
+	}
+
+	if ( m_expiry + milliseconds( probe_ms ) < now ) m_expiry = now;
+	arm();
+}
+
+
+LoopMonitor::Handler::~Handler()
+{
+	const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - m_start ).count();
+	if ( stall_ms <= ms ) stall( m_cmd, ms );
+}
+
+
+void LoopMonitor::stall( unsigned int cmd, long long ms )
+{
+	auto& stalls = s_stalls[cmd];
+	++stalls.count;
+	stalls.max_ms = std::max( stalls.max_ms, ms );
+	if ( cmd ) s_attributed = true;
+
+	const auto now = std::chrono::steady_clock::now();
+	if ( std::chrono::seconds( 1 ) > now - s_last_warning ) return;
+	s_last_warning = now;
+	std::cerr << "[WARNING] Event loop stalled for " << ms << " ms";
+	if ( cmd ) std::cerr << " handling 0x" << std::hex << cmd << std::dec;
+	std::cerr << "\n";
+}
+
+
+LoopMonitor::Figures LoopMonitor::figures()
+{
+	Figures f = {};
+	f.busy_permille = s_busy_last;
+	f.probes        = s_probes;
+	f.lag_max_us    = static_cast<unsigned long long>( s_lag_max );
+	std::copy( s_lag_buckets, s_lag_buckets + lag_buckets, f.lag );
+	for ( const auto& it : s_stalls ) f.stalls += it.second.count;
+	return f;
+}
+
+
+void LoopMonitor::print( std::ostream& out )
+{
+	out << "event loop busy: ";
+	if ( 0 <= s_busy_last ) out << s_busy_last / 10.0 << "% last " << window_probes * probe_ms / 1000 << " s, max " << s_busy_max / 10.0 << "%";
+	else                    out << "-";
+
+	out << "\nevent loop lag (" << s_probes << " probes, max " << s_lag_max / 1000.0 << " ms):";
+	for ( unsigned int bucket = 0; lag_buckets > bucket; ++bucket )
+	{
+		if ( !s_lag_buckets[bucket] ) continue;
+		if ( lag_buckets - 1 > bucket ) out << " <" << ( 1 << bucket ) << " ms " << s_lag_buckets[bucket];
+		else                            out << " longer " << s_lag_buckets[bucket];
+	}
+
+	out << "\nevent loop stalls of " << stall_ms << " ms or more:";
+	if ( s_stalls.empty() ) out << " none";
+	for ( const auto& it : s_stalls )
+	{
+		out << " ";
+		if ( it.first ) out << "0x" << std::hex << it.first << std::dec;
+		else            out << "other";
+		out << " " << it.second.count << " (max " << it.second.max_ms << " ms)";
+	}
+	out << "\n";
+}
@@ -0,0 +1,78 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	Everything runs in one event loop, so a slow handler (a big 0x19b
+	login snapshot, a blocking console write, copying a 1 MiB frame)
+	delays every game on the server. The LoopMonitor finds such stalls
+	before the players complain:
+	  - a probe timer expires every probe_ms; how late its handler runs
+	    is the scheduling delay, collected in a histogram
+	  - the thread CPU time used between probes gives the busy ratio of
+	    the loop, reported per window of window_probes probes
+	  - packet handlers are timed by a Handler guard (see Session), one
+	    running for stall_ms or longer is counted with its command code;
+	    late probes without such a handler count as "other"
+	Stalls are also logged, at most once per second.
+
+	Counters are static like the other diagnostics, see print().
+*/
+class LoopMonitor
+{
+public:
+	enum { probe_ms      = 100 };
+	enum { stall_ms      = 50  };
+	enum { window_probes = 100 };//10 s
+	//<1 ms, <2 ms, <4 ms, ... <1024 ms, longer
+	enum { lag_buckets   = 12  };
+
+	explicit LoopMonitor( asio::io_service& io_service );
+
+	//times the packet handler for cmd while in scope
+	class Handler
+	{
+	public:
+		explicit Handler( unsigned int cmd ) : m_cmd( cmd ), m_start( std::chrono::steady_clock::now() ) {};
+		~Handler();
+		Handler( const Handler& ) = delete;
+		Handler& operator =( const Handler& ) = delete;
+
+	private:
+		const unsigned int                          m_cmd;
+		const std::chrono::steady_clock::time_point m_start;
+	};
+
+	static void print( std::ostream& out );
+
+	//current counters, see StatsSegment
+	struct Figures
+	{
+		long long          busy_permille;//last window, -1: not known yet
+		unsigned long long probes;
+		unsigned long long lag_max_us;
+		unsigned long long lag[lag_buckets];
+		unsigned long long stalls;
+	};
+	static Figures figures();
+
+private:
+	void arm();
+	void probe();
+
+	//cmd 0: not attributed to a packet handler
+	static void stall( unsigned int cmd, long long ms );
+
+	asio::steady_timer                    m_timer;
+	std::chrono::steady_clock::time_point m_expiry;
+
+	//busy ratio of the current window
+	unsigned int                          m_window_probes;
+	std::chrono::steady_clock::time_point m_window_start;
+	long long                             m_window_cpu_ns;
+};
@@ -0,0 +1,182 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "Options.hpp"
+
+static unsigned short parse_port( const std::string& s )
+{
+	size_t end = 0;
+	unsigned long p = 0;
+	try
+	{
+		p = std::stoul( s, &end );
+	}
+	catch ( const std::exception& )
+	{
+		end = 0;
+	}
+	if ( end != s.size() || 0 == p || 0xffff < p )
+	{
+		throw std::invalid_argument( "invalid port number: " + s );
+	}
+	return static_cast<unsigned short>( p );
+}
+
+
+static unsigned int parse_number( const std::string& s, unsigned long max )
+{
+	size_t end = 0;
+	unsigned long n = 0;
+	try
+	{
+		n = std::stoul( s, &end );
+	}
+	catch ( const std::exception& )
+	{
+		end = 0;
+	}
+	if ( 0 == end || end != s.size() || max < n )
+	{
+		throw std::invalid_argument( "invalid number: " + s );
+	}
+	return static_cast<unsigned int>( n );
+}
+
+
+//longest accepted timeout, one week
+static const unsigned long max_seconds = 86400 * 7;
+
+
+/*
+	Parses "--name value" pairs. Options can be repeated where it makes
+	sense (--peer), otherwise the last one wins.
+*/
+Options parse_options( int argc, char* argv[] )
+{
+	Options o;
+	for ( int i = 1; i < argc; ++i )
+	{
+		const std::string arg( argv[i] );
+		if ( "--help" == arg || "-h" == arg )
+		{
+			throw std::invalid_argument( "" );
+		}
+		if ( argc <= i + 1 )
+		{
+			throw std::invalid_argument( "missing value for " + arg );
+		}
+		const std::string value( argv[++i] );
+
+		if ( "--port" == arg )
+		{
+			o.port = parse_port( value );
+		}
+		else if ( "--federation-port" == arg )
+		{
+			o.federation_port = parse_port( value );
+		}
+		else if ( "--peer" == arg )
+		{
+			const auto colon = value.rfind( ':' );
+			if ( std::string::npos == colon || 0 == colon )
+			{
+				throw std::invalid_argument( "peer must be given as host:port: " + value );
+			}
+			parse_port( value.substr( colon + 1 ) );
+			o.peers.push_back( value );
+		}
+		else if ( "--login-timeout" == arg )
+		{
+			o.login_timeout = parse_number( value, max_seconds );
+		}
+		else if ( "--idle-timeout" == arg )
+		{
+			o.idle_timeout = parse_number( value, max_seconds );
+		}
+		else if ( "--send-timeout" == arg )
+		{
+			o.send_timeout = parse_number( value, max_seconds );
+		}
+		else if ( "--game-timeout" == arg )
+		{
+			o.game_timeout = parse_number( value, 600 );
+		}
+		else if ( "--max-sessions" == arg )
+		{
+			o.max_sessions = parse_number( value, 1000000 );
+		}
+		else if ( "--max-per-address" == arg )
+		{
+			o.max_per_address = parse_number( value, 1000000 );
+		}
+		else if ( "--memory-budget" == arg )
+		{
+			o.memory_budget = parse_number( value, 1 << 20 );
+		}
+		else if ( "--coalesce-ms" == arg )
+		{
+			o.coalesce_ms = parse_number( value, 10000 );
+		}
+		else if ( "--tcp-sample" == arg )
+		{
+			o.tcp_sample = parse_number( value, 3600 );
+		}
+		else if ( "--zerocopy-min" == arg )
+		{
+			o.zerocopy_min = parse_number( value, 1 << 30 );
+		}
+		else if ( "--stats-shm" == arg )
+		{
+			o.stats_shm = value;
+		}
+		else if ( "--admin" == arg )
+		{
+			o.admin = value;
+		}
+		else if ( "--handoff" == arg )
+		{
+			o.handoff = value;
+		}
+		else
+		{
+			throw std::invalid_argument( "unknown option: " + arg );
+		}
+	}
+	return o;
+}
+
+
+void print_usage( std::ostream& out )
+{
+	out << "Usage: cossacks3-server [options]\n"
+	    << "  --port N             TCP port for game clients (default " << port << ")\n"
+	    << "  --federation-port N  accept links from other servers on port N\n"
+	    << "  --peer HOST:PORT     link to the federation port of another server\n"
+	    << "                       (can be repeated; link each pair of servers once)\n"
+	    << "  --login-timeout S    close connections without login after S seconds (default 30)\n"
+	    << "  --idle-timeout S     close connections which sent nothing for S seconds (default 0: never;\n"
+	    << "                       the game sends nothing while a player idles in the lobby)\n"
+	    << "  --send-timeout S     close connections which accept no data for S seconds (default 60)\n"
+	    << "  --game-timeout S     detect dead connections of players in a running game\n"
+	    << "                       within about S seconds (default 5, 0: disabled)\n"
+	    << "  --max-sessions N     accept at most N connections (default 1000)\n"
+	    << "  --max-per-address N  accept at most N connections per IP address (default 16)\n"
+	    << "  --memory-budget MiB  memory for receive buffers and send queues (default 512)\n"
+	    << "  --coalesce-ms MS     send room and status updates at most every MS milliseconds\n"
+	    << "                       per room or player (default 40, 0: send every update)\n"
+	    << "  --tcp-sample S       sample round trip, retransmits and unsent bytes of every\n"
+	    << "                       connection every S seconds (default 1, 0: disabled)\n"
+	    << "  --zerocopy-min N     send buffers of N bytes or more with MSG_ZEROCOPY (Linux;\n"
+	    << "                       default 0: disabled; try 65536 for big map broadcasts)\n"
+	    << "  --stats-shm NAME     publish live statistics in shared memory /dev/shm/NAME\n"
+	    << "                       (Linux; read them with cossacks3-stats NAME)\n"
+	    << "  --admin PATH         operator console on the Unix socket PATH: lists players,\n"
+	    << "                       rooms and connections, kicks clients\n"
+	    << "  --handoff PATH       take over clients from the server listening on the\n"
+	    << "                       Unix socket PATH, then listen there for a successor\n";
+}
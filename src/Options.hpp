@@ -0,0 +1,61 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+//TCP port to listen on (default 31523)
+const unsigned short port = 31523;
+
+/*
+	Command line options. Without any arguments the server behaves as
+	before: it listens on the default port and runs on its own.
+*/
+struct Options
+{
+	unsigned short port = ::port;
+
+	//TCP port for incoming links from other servers (0: do not listen)
+	unsigned short federation_port = 0;
+	//other servers to link to, as host:port of their federation port
+	std::vector<std::string> peers;
+
+	//connection deadlines in seconds (see Session::check_deadlines()), 0: disabled
+	unsigned int login_timeout = 30;
+	unsigned int idle_timeout  = 0;
+	unsigned int send_timeout  = 60;
+	//bound for detecting dead connections of players in a running game
+	//(see Session::set_in_game()), 0: disabled
+	unsigned int game_timeout  = 5;
+
+	//admission control, see Admission class
+	unsigned int max_sessions    = 1000;
+	unsigned int max_per_address = 16;
+	unsigned int memory_budget   = 512;//MiB
+
+	//window for coalescing room and status updates in ms (see Lobby class), 0: disabled
+	unsigned int coalesce_ms = 40;
+
+	//seconds between TCP_INFO samples of all connections (see TcpMonitor class), 0: disabled
+	unsigned int tcp_sample = 1;
+
+	//smallest send buffer sent with MSG_ZEROCOPY (see ZeroCopy class), 0: disabled
+	unsigned int zerocopy_min = 0;
+
+	//POSIX shared memory name for live statistics (see StatsSegment class), empty: disabled
+	std::string stats_shm;
+
+	//Unix socket path for the operator console (see AdminConsole class), empty: disabled
+	std::string admin;
+
+	//Unix socket path for hot restart (see Handoff class), empty: disabled
+	std::string handoff;
+};
+
+//throws std::invalid_argument on unknown or malformed arguments
+Options parse_options( int argc, char* argv[] );
+
+void print_usage( std::ostream& out );
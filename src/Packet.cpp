@@ -13,9 +13,9 @@
 */
 Packet::Packet( Buffer& buf, unsigned int source_id ):
 	m_source_id( source_id ),
-	m_buf      ( buf ),
+	m_send_size( 0 ),
 	m_seek_pos ( 0 ),
-	m_send_size( 0 )
+	m_buf      ( buf )
 {
 	m_size = read_int();
 	m_cmd  = read_short();
@@ -49,26 +49,33 @@ std::ostream& operator<< ( std::ostream &out, const Packet &p )
 
 
 /*
-	Read value according to name, advance seek position.
+	Read value according to name, advance seek position. Reading beyond
+	the end of the buffer yields zeros, so malformed packets can not read
+	foreign memory.
 */
 unsigned char Packet::read_byte()
 {
+	if ( m_buf.size() <= m_seek_pos )
+	{
+		++m_seek_pos;
+		return 0;
+	}
 	return m_buf[m_seek_pos++];
 }
 unsigned short Packet::read_short()
 {
 	byte_short si;
-	si.b[0] = m_buf[m_seek_pos++];
-	si.b[1] = m_buf[m_seek_pos++];
+	si.b[0] = read_byte();
+	si.b[1] = read_byte();
 	return si.s;
 }
 unsigned int Packet::read_int()
 {
 	byte_int bi;
-	bi.b[0] = m_buf[m_seek_pos++];
-	bi.b[1] = m_buf[m_seek_pos++];
-	bi.b[2] = m_buf[m_seek_pos++];
-	bi.b[3] = m_buf[m_seek_pos++];
+	bi.b[0] = read_byte();
+	bi.b[1] = read_byte();
+	bi.b[2] = read_byte();
+	bi.b[3] = read_byte();
 	return bi.i;
 }
 //LengthType describes how many bytes in front of the string contain it's length
@@ -78,17 +85,20 @@ std::string Packet::read_string( LengthType lt )//default: Byte
 	if      ( Byte  == lt ) l = read_byte();
 	else if ( Short == lt ) l = read_short();
 	else if ( Int   == lt ) l = read_int();
-	const std::string str( reinterpret_cast<const char*>( &m_buf[m_seek_pos] ), l );
+	const size_t available = m_seek_pos < m_buf.size() ? m_buf.size() - m_seek_pos : 0;
+	const std::string str( reinterpret_cast<const char*>( m_buf.data() + m_seek_pos ), std::min( l, available ) );
 	m_seek_pos += static_cast<unsigned int>( l );
 	return str;
 }
 
 
 /*
-	Write value according to name, advance seek position.
+	Write value according to name, advance seek position. The buffer grows
+	if necessary (Session buffers start small, see Session::do_read()).
 */
 void Packet::write_byte( unsigned char b )
 {
+	reserve( 1 );
 	m_buf[m_seek_pos++] = b;
 }
 void Packet::write_short( unsigned short s )
@@ -114,8 +124,15 @@ void Packet::write_string( const std::string& str, LengthType lt )//default: Byt
 	if      ( Byte  == lt ) write_byte ( static_cast<unsigned char> ( l ) );
 	else if ( Short == lt )	write_short( static_cast<unsigned short>( l ) );
 	else if ( Int   == lt )	write_int  ( static_cast<unsigned int>  ( l ) );
-	std::memcpy( &m_buf[m_seek_pos], str.c_str(), l );
-	m_seek_pos += static_cast<unsigned int> ( l );
+	write_bytes( str.c_str(), l );
+}
+
+
+void Packet::write_bytes( const void* data, size_t n )
+{
+	reserve( n );
+	std::memcpy( m_buf.data() + m_seek_pos, data, n );
+	m_seek_pos += static_cast<unsigned int> ( n );
 }
 
 
@@ -149,3 +166,10 @@ void Packet::keep_whole_message( unsigned short cmd )
 	seek_to_end();
 	write_header( cmd, m_id1, m_id2 );
 }
+
+
+void Packet::reserve( size_t n )
+{
+	if ( m_seek_pos + n <= m_buf.size() ) return;
+	m_buf.resize( std::max( m_seek_pos + n, 2 * m_buf.size() ) );
+}
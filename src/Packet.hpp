@@ -34,6 +34,9 @@ public:
 	//move seek position forward, useful for skipping bytes
 	void seek( unsigned int offset ) { m_seek_pos += offset; };
 
+	//current seek position, counted from packet start
+	unsigned int seek_pos() const { return m_seek_pos; };
+
 	//move seek position to the start or the end of data section
 	//useful for overwriting data or for keeping and forwarding it
 	void seek_to_start() { m_seek_pos = packet_header_size;          };
@@ -50,6 +53,8 @@ public:
 	void write_short ( unsigned short s );
 	void write_int   ( unsigned int   i );
 	void write_string( const std::string& str, LengthType lt = Byte );
+	//raw bytes without length prefix
+	void write_bytes ( const void* data, size_t n );
 
 	//has to be called before the packet is passed to send()
 	void write_header( unsigned short cmd, unsigned int id1 = 0, unsigned int id2 = 0 );
@@ -71,6 +76,9 @@ public:
 
 
 private:
+	//grows the buffer to fit n more bytes at the seek position
+	void reserve( size_t n );
+
 	union byte_int
 	{
 		unsigned char b[4];
@@ -0,0 +1,288 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "Packet.hpp"
+#include "Partitions.hpp"
+
+/*
+	Assigns an ID and parks the Client in the reception Lobby until login.
+*/
+void Partitions::connect( std::shared_ptr<Client> client )
+{
+	m_reception.connect( client );
+}
+
+
+/*
+	Passes the disconnect to the Client's partition. The Client is detached
+	at once, its Player leaves at the end of the event loop turn together
+	with all others disconnecting in the same turn (see flush_disconnects()).
+*/
+void Partitions::disconnect( std::shared_ptr<Client> client )
+{
+	const auto id = client->id();
+	const auto it = m_assignment.find( id );
+	if ( m_assignment.end() == it )
+	{
+		m_reception.disconnect( client );
+		return;
+	}
+
+	const auto key = it->second;
+	m_assignment.erase( it );
+
+	auto lobby = m_lobbies.find( key );
+	if ( m_lobbies.end() == lobby ) return;//should never happen
+
+	lobby->second->detach( client );
+	m_departing[key].push_back( client );
+
+	if ( m_disconnects_posted ) return;
+	m_disconnects_posted = true;
+	m_io_service.post( [this]() { flush_disconnects(); } );
+}
+
+
+/*
+	Lets the Players of the detached Clients leave, one batch per partition.
+	Partitions without any Clients, Players and Rooms left are closed.
+*/
+void Partitions::flush_disconnects()
+{
+	m_disconnects_posted = false;
+	const auto departing = std::move( m_departing );
+	m_departing.clear();
+
+	for ( const auto& it : departing )
+	{
+		auto lobby = m_lobbies.find( it.first );
+		if ( m_lobbies.end() == lobby ) continue;//should never happen
+
+		lobby->second->disconnect( it.second );
+		close_if_empty( it.first );
+	}
+}
+
+
+/*
+	Closes the partition if no Clients, Players and Rooms are left.
+	Remote Players and Rooms keep a partition open (see Federation).
+*/
+void Partitions::close_if_empty( const std::string& key )
+{
+	auto lobby = m_lobbies.find( key );
+	if ( m_lobbies.end() == lobby || !lobby->second->empty() ) return;
+
+	std::cout << "Closed lobby for client version " << key << std::endl;
+	m_lobbies.erase( lobby );
+}
+
+
+/*
+	Routes the packet to the Client's partition. The 0x19a login message
+	of a Client in reception moves it to its partition first.
+*/
+void Partitions::process_buf( std::shared_ptr<Client> client )
+{
+	if ( m_assignment.end() == m_assignment.find( client->id() ) )
+	{
+		const Packet p( client->buf(), client->id() );
+		if ( 0x19a == p.cmd() )
+		{
+			assign( client );
+		}
+	}
+	lobby_of( client->id() ).process_buf( client );
+}
+
+
+/*
+	Reads ver1 and ver2 from the 0x19a login message in the Client buffer
+	(see Lobby::process_buf() for format) and moves the Client from the
+	reception to the matching partition. Leaves the buffer untouched.
+*/
+void Partitions::assign( std::shared_ptr<Client> client )
+{
+	const auto id = client->id();
+	Packet p( client->buf(), id );
+	const auto ver1 = p.read_string();
+	const auto ver2 = p.read_string();
+	const auto key  = ver1 + ' ' + ver2;
+
+	m_reception.release( id );
+	lobby( key ).adopt( client );
+	m_assignment.emplace( id, key );
+}
+
+
+/*
+	Returns the partition for the client version key, creates it if
+	it does not exist yet.
+*/
+Lobby& Partitions::lobby( const std::string& key )
+{
+	auto& lobby = m_lobbies[key];
+	if ( !lobby )
+	{
+		lobby = std::make_unique<Lobby>( m_io_service, m_last_issued_id, m_coalesce_ms );
+		lobby->set_chat_listener(
+		[this, key]( unsigned int id, const std::string& text )
+		{
+			if ( m_chat_listener ) m_chat_listener( key, id, text );
+		} );
+		std::cout << "Opened lobby for client version " << key << std::endl;
+	}
+	return *lobby;
+}
+
+
+/*
+	Returns the partition of the Client, or the reception if the Client
+	did not log in yet.
+*/
+Lobby& Partitions::lobby_of( unsigned int client_id )
+{
+	const auto it = m_assignment.find( client_id );
+	if ( m_assignment.end() == it ) return m_reception;
+
+	const auto lobby = m_lobbies.find( it->second );
+	if ( m_lobbies.end() == lobby ) return m_reception;//should never happen
+	return *lobby->second;
+}
+
+
+void Partitions::print_clients( std::ostream& out ) const
+{
+	out << "[reception]\n";
+	m_reception.print_clients( out );
+	for ( const auto& it : m_lobbies )
+	{
+		out << "[" << it.first << "]\n";
+		it.second->print_clients( out );
+		it.second->print_relay_lag( out );
+	}
+}
+
+
+void Partitions::print_players( std::ostream& out ) const
+{
+	for ( const auto& it : m_lobbies )
+	{
+		out << "[" << it.first << "]\n";
+		it.second->print_players( out );
+	}
+}
+
+
+void Partitions::print_rooms( std::ostream& out ) const
+{
+	for ( const auto& it : m_lobbies )
+	{
+		out << "[" << it.first << "]\n";
+		it.second->print_rooms( out );
+	}
+}
+
+
+//Client IDs are unique over all partitions, so are room host IDs
+bool Partitions::print_room( unsigned int host_id, std::ostream& out ) const
+{
+	for ( const auto& it : m_lobbies )
+	{
+		if ( it.second->print_room( host_id, out ) ) return true;
+	}
+	return false;
+}
+
+
+void Partitions::census( Lobby::Census& census ) const
+{
+	m_reception.add_to( census );
+	for ( const auto& it : m_lobbies ) it.second->add_to( census );
+}
+
+
+void Partitions::suspend()
+{
+	//the saved state must not contain Players of closed connections
+	flush_disconnects();
+	m_reception.suspend();
+	for ( const auto& it : m_lobbies ) it.second->suspend();
+}
+
+
+bool Partitions::suspended() const
+{
+	if ( !m_reception.suspended() ) return false;
+	for ( const auto& it : m_lobbies )
+	{
+		if ( !it.second->suspended() ) return false;
+	}
+	return true;
+}
+
+
+void Partitions::resume()
+{
+	m_reception.resume();
+	for ( const auto& it : m_lobbies ) it.second->resume();
+}
+
+
+void Partitions::save( Handoff& handoff ) const
+{
+	handoff.send( Handoff::Counter, m_last_issued_id );
+
+	Buffer buf;
+	for ( const auto& it : m_lobbies )
+	{
+		buf.assign( Packet::packet_header_size + 2 + it.first.size(), 0 );
+		Packet p( buf, 0 );
+		p.seek_to_start();
+		p.write_string( it.first, Packet::Short );
+		p.write_header( Handoff::Partition );
+		handoff.send( buf, p.send_size() );
+		it.second->save( handoff );
+	}
+
+	m_reception.save_clients( handoff, "" );
+	for ( const auto& it : m_lobbies ) it.second->save_clients( handoff, it.first );
+}
+
+
+void Partitions::restore( Packet& p )
+{
+	if      ( Handoff::Counter   == p.cmd() )
+	{
+		m_last_issued_id = p.id1();
+	}
+	else if ( Handoff::Partition == p.cmd() )
+	{
+		m_restore_key = p.read_string( Packet::Short );
+	}
+	else if ( !m_restore_key.empty() )
+	{
+		lobby( m_restore_key ).restore( p );
+	}
+}
+
+
+/*
+	Registers a Client taken over from another process in its partition
+	(empty key: reception) without issuing a new ID.
+*/
+void Partitions::adopt( std::shared_ptr<Client> client, const std::string& key )
+{
+	if ( key.empty() )
+	{
+		m_reception.adopt( client );
+		return;
+	}
+	lobby( key ).adopt( client );
+	m_assignment.emplace( client->id(), key );
+}
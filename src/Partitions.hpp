@@ -0,0 +1,107 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "Client.hpp"
+#include "Lobby.hpp"
+
+/*
+	The Partitions class hosts one independent Lobby per client version.
+	Clients with different builds can not play together, so there is no
+	point in showing them each other's rooms or broadcasting to them.
+
+	New Clients wait in the reception Lobby until they send the 0x19a login
+	message. Its ver1 and ver2 strings select (or create) the partition the
+	Client is moved to. From then on all packets of the Client are handled
+	by its partition only, so broadcasts and the 0x19b login snapshot scale
+	with the partition instead of the whole server.
+
+	Partitions share no state except the Client ID counter.
+*/
+class Partitions
+{
+public:
+	Partitions( asio::io_service& io_service, unsigned int coalesce_ms ) :
+		m_io_service( io_service ), m_last_issued_id( 0 ), m_coalesce_ms( coalesce_ms ),
+		m_reception( io_service, m_last_issued_id, coalesce_ms ),
+		m_disconnects_posted( false )
+	{};
+
+	void connect    ( std::shared_ptr<Client> client );
+	void disconnect ( std::shared_ptr<Client> client );
+	void process_buf( std::shared_ptr<Client> client );
+	//see Lobby::open_stream()
+	bool open_stream( std::shared_ptr<Client> client, const BufPtr& stream, std::vector<std::shared_ptr<Client>>& targets )
+	{ return lobby_of( client->id() ).open_stream( client, stream, targets ); };
+
+	//true once the Client sent 0x19a and was moved to its partition
+	bool logged_in( unsigned int client_id ) const { return 0 != m_assignment.count( client_id ); };
+
+	//prints send queue state and TCP statistics of every connected Client
+	//and relay round trips of every room, grouped by partition
+	void print_clients( std::ostream& out ) const;
+	//admin console views and actions over all partitions, see AdminConsole class
+	void print_players( std::ostream& out ) const;
+	void print_rooms  ( std::ostream& out ) const;
+	bool print_room   ( unsigned int host_id, std::ostream& out ) const;
+	bool kick         ( unsigned int client_id ) { return lobby_of( client_id ).kick( client_id ); };
+	//Lobby::Census over all partitions and reception
+	void census( Lobby::Census& census ) const;
+	size_t partition_count() const { return m_lobbies.size(); };
+
+	//access for replication between servers, see Federation class
+	const std::map<std::string, std::unique_ptr<Lobby>>& lobbies() const { return m_lobbies; };
+	Lobby& lobby         ( const std::string& key );//creates the partition if necessary
+	void   close_if_empty( const std::string& key );
+
+	/*
+		Hot restart, see Handoff class. save() sends the Client ID counter,
+		then Players and Rooms of every partition, then all Sessions.
+		restore() takes the records except Sessions, which are handed to
+		adopt() with their partition key.
+	*/
+	void suspend();
+	bool suspended() const;
+	void resume();
+	void save   ( Handoff& handoff ) const;
+	void restore( Packet& p );
+	void adopt  ( std::shared_ptr<Client> client, const std::string& key );
+
+	//called for public chat messages of local players in any partition
+	void set_chat_listener( std::function<void( const std::string&, unsigned int, const std::string& )> listener )
+	{ m_chat_listener = listener; };
+
+private:
+	Lobby& lobby_of( unsigned int client_id );
+	void   assign  ( std::shared_ptr<Client> client );
+
+	void flush_disconnects();
+
+	asio::io_service& m_io_service;
+
+	//increment IDs independent of current map size, used by all partitions
+	unsigned int m_last_issued_id;
+
+	//see Lobby class
+	const unsigned int m_coalesce_ms;
+
+	//Clients which did not log in yet
+	Lobby m_reception;
+
+	std::map<std::string, std::unique_ptr<Lobby>> m_lobbies;   //key: ver1 + ' ' + ver2
+	std::map<unsigned int, std::string>           m_assignment;//key: Client ID, value: m_lobbies key
+
+	//detached Clients per m_lobbies key, Players leave in flush_disconnects()
+	std::map<std::string, std::vector<std::shared_ptr<Client>>> m_departing;
+	bool m_disconnects_posted;
+
+	//partition selected by the last Handoff::Partition record
+	std::string m_restore_key;
+
+	std::function<void( const std::string&, unsigned int, const std::string& )> m_chat_listener;
+};
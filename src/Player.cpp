@@ -41,4 +41,75 @@ void Player::leave_room()
 		m_room->remove_player( m_id );
 		m_room = nullptr;
 	}
-}
\ No newline at end of file
+}
+
+
+/*
+	Records the subject of a lobby notification which was not sent to
+	this player. A player who joins and leaves the lobby within the same
+	game cancels out. Public chat (0x197) is not replayed.
+*/
+void Player::miss( unsigned short cmd, unsigned int id )
+{
+	if ( 0x1a6 != cmd && 0x1a7 != cmd && 0x1ac != cmd && 0x19d != cmd && 0x1a5 != cmd ) return;
+	if ( !m_missed ) m_missed = std::make_unique<Missed>();
+	auto& m = *m_missed;
+
+	if      ( 0x1a6 == cmd )
+	{
+		m.joined.insert( id );
+	}
+	else if ( 0x1a7 == cmd )
+	{
+		if ( 0 == m.joined.erase( id ) ) m.left.insert( id );
+		m.status.erase( id );
+	}
+	else if ( 0x1ac == cmd )
+	{
+		m.status.insert( id );
+	}
+	else if ( 0x19d == cmd )
+	{
+		m.rooms_created.insert( id );
+	}
+	else if ( 0x1a5 == cmd )
+	{
+		m.rooms_updated.insert( id );
+	}
+}
+
+
+Player::Missed Player::take_missed()
+{
+	Missed missed;
+	if ( m_missed ) std::swap( missed, *m_missed );
+	m_missed.reset();
+	return missed;
+}
+
+
+const Player::Missed& Player::missed() const
+{
+	static const Missed none;
+	return m_missed ? *m_missed : none;
+}
+
+
+void Player::set_missed( const Missed& m )
+{
+	if ( m.joined.empty() && m.left.empty() && m.status.empty() && m.rooms_created.empty() && m.rooms_updated.empty() )
+	{
+		m_missed.reset();
+	}
+	else
+	{
+		m_missed = std::make_unique<Missed>( m );
+	}
+}
+
+
+const Interned& Player::default_props()
+{
+	static const Interned props( "pur|0|dlc|0|ram|4|sic|0|si1|0|si2|0|si3|0|snc||sn1||sn2||sn3|" );
+	return props;
+}
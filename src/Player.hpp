@@ -7,7 +7,9 @@
 #pragma once
 #include "Precompiled.hpp"
 
+#include "Interned.hpp"
 #include "Room.hpp"
+#include "Trace.hpp"
 
 /*
 	Player class stores player data which must be presented to newcomers
@@ -16,10 +18,28 @@
 
 	Provides helper functions for joining and leaving rooms, which also take
 	care of Room state.
+
+	Versions and properties are the same for most players and are kept as
+	Interned handles. All string accessors return borrowed references.
+
+	While the player is in a running game, lobby-only notifications are not
+	sent to the player. Instead the Player remembers which players and rooms they
+	were about, so Lobby::catch_up() can send the current state once the
+	player returns to the lobby.
 */
 class Player
 {
 public:
+	//lobby notifications missed while in a game, by subject ID
+	struct Missed
+	{
+		std::set<unsigned int> joined;       //0x1a6
+		std::set<unsigned int> left;         //0x1a7
+		std::set<unsigned int> status;       //0x1ac
+		std::set<unsigned int> rooms_created;//0x19d, key: room host id
+		std::set<unsigned int> rooms_updated;//0x1a5, key: room host id
+	};
+
 	/*
 		The Player ID is set by Lobby::connect as Client ID. Name is derived
 		from Game Key input (see Lobby::process_buf(), 0x19a branch for
@@ -27,40 +47,70 @@ public:
 		login. State 0x01 means "in lobby". Use default properties string.
 	*/
 	Player( int id, std::string name, std::string ver1, std::string ver2 ) :
-		m_id( id ), m_name( name ), m_ver1( ver1 ), m_ver2( ver2 ),
-		m_status( 0x01 ), m_room( nullptr ),
+		m_name( std::move( name ) ), m_ver1( ver1 ), m_ver2( ver2 ),
 		//m_score( "ps=1000|pw=0|pg=0" ),
-		m_props( "pur|0|dlc|0|ram|4|sic|0|si1|0|si2|0|si3|0|snc||sn1||sn2||sn3|" )
+		m_props( default_props() ), m_room( nullptr ), m_id( id ),
+		m_status( 0x01 ), m_announced_status( 0x01 ), m_remote( false )
 	{};
 
 	unsigned int      id() const { return m_id;     };
 	unsigned char status() const { return m_status; };
 
-	std::string name()  const { return m_name;  };
-	std::string ver1()  const { return m_ver1;  };
-	std::string ver2()  const { return m_ver2;  };
+	//0x0b: member in a game; 0x0f: host in a game
+	bool in_game() const { return 0x0b == m_status || 0x0f == m_status; };
+
+	//last status byte sent by the client through 0x1ab
+	unsigned char announced_status() const { return m_announced_status; };
+	void set_announced_status( unsigned char s ) { m_announced_status = s; };
+
+	const std::string& name()  const { return m_name;        };
+	const std::string& ver1()  const { return m_ver1.str();  };
+	const std::string& ver2()  const { return m_ver2.str();  };
 	//std::string score() const { return m_score; };
-	std::string props() const { return m_props; };
+	const std::string& props() const { return m_props.str(); };
 
 	void set_status ( unsigned char s ) { m_status  = s; };
-	void set_props  ( const std::string& props ) { m_props = props; };
+	void set_props  ( const std::string& props ) { if ( props != m_props.str() ) m_props = Interned( props ); };
+
+	//players replicated from another server have no Client (see Federation)
+	bool is_remote() const { return m_remote; };
+	void set_remote()      { m_remote = true; };
 	
 	Room* room() { return m_room; };
+	const Room* room() const { return m_room; };
 	void join_room( Room& room );
 	void leave_room();
 
+	//remember a suppressed lobby notification (cmd) about player or room id
+	void miss( unsigned short cmd, unsigned int id );
+	bool has_missed() const { return nullptr != m_missed; };
+	//returns and clears everything missed so far
+	Missed take_missed();
+	//access for hot restart, see Lobby::save()
+	const Missed& missed() const;
+	void set_missed( const Missed& m );
+
 private:
-	const unsigned int m_id;
+	//shared by all players until they send their own properties
+	static const Interned& default_props();
+
 	const std::string m_name;
 	
 	//four digit version string (1.0.0.7), unknown purpose
-	const std::string m_ver1;
+	const Interned m_ver1;
 	//three digit version string (2.0.7), displayed in game menu
-	const std::string m_ver2;
+	const Interned m_ver2;
 	//client score string (ps=%d|pw=%d|pg=%d)
 	//std::string m_score;
 	//client properties string (pur|%d|dlc|%d|ram|%d|...)
-	std::string m_props;
+	Interned m_props;
+
+	Room* m_room;
+
+	//only allocated while something was missed
+	std::unique_ptr<Missed> m_missed;
+
+	const unsigned int m_id;
 
 	/* status values:
 	   1  default / in lobby
@@ -70,6 +120,8 @@ private:
 	   f  host in a game
 	*/
 	unsigned char m_status;
+	unsigned char m_announced_status;
+	bool          m_remote;
 
-	Room* m_room;
+	Trace<Player> m_trace;
 };
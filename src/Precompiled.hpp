@@ -8,7 +8,11 @@
 #pragma warning( push, 0 )
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <deque>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -16,6 +20,7 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
 
 #define ASIO_STANDALONE
@@ -23,5 +28,4 @@
 
 #pragma warning( pop )
 
-typedef std::vector<unsigned char> Buffer;
-typedef std::shared_ptr<Buffer>    BufPtr;
\ No newline at end of file
+typedef std::vector<unsigned char> Buffer;
\ No newline at end of file
@@ -0,0 +1,70 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "RelayLag.hpp"
+
+
+void RelayLag::sent( unsigned int receiver_id, Clock::time_point now )
+{
+	auto& r = m_receivers[receiver_id];
+	if ( max_outstanding <= r.outstanding.size() )
+	{
+		r.outstanding.pop_front();
+		++r.unmatched;
+	}
+	r.outstanding.push_back( now );
+}
+
+
+void RelayLag::acknowledged( unsigned int receiver_id, Clock::time_point now )
+{
+	const auto it = m_receivers.find( receiver_id );
+	if ( m_receivers.end() == it || it->second.outstanding.empty() ) return;
+
+	auto& r = it->second;
+	sample( r, r.outstanding.front(), now );
+	r.outstanding.pop_front();
+}
+
+
+/*
+	The newest frame gives the round trip, the older ones were received
+	before it.
+*/
+void RelayLag::completed( unsigned int receiver_id, Clock::time_point now )
+{
+	const auto it = m_receivers.find( receiver_id );
+	if ( m_receivers.end() == it || it->second.outstanding.empty() ) return;
+
+	auto& r = it->second;
+	sample( r, r.outstanding.back(), now );
+	r.outstanding.clear();
+}
+
+
+void RelayLag::sample( Receiver& r, Clock::time_point sent, Clock::time_point now )
+{
+	const long long us = std::chrono::duration_cast<std::chrono::microseconds>( now - sent ).count();
+	r.smoothed_us = r.samples ? r.smoothed_us + ( us - r.smoothed_us ) / 8 : us;
+	r.last_us = us;
+	r.max_us  = std::max( r.max_us, us );
+	++r.samples;
+}
+
+
+void RelayLag::print( std::ostream& out, unsigned int host_id, const std::function<std::string( unsigned int )>& name_of ) const
+{
+	for ( const auto& it : m_receivers )
+	{
+		const auto& r = it.second;
+		out << "  " << std::left << std::setw( 6 ) << it.first << std::setw( 18 ) << name_of( it.first )
+		    << std::setw( 7 ) << ( host_id == it.first ? "host" : "" ) << std::right
+		    << std::setw( 10 ) << r.samples << std::setw( 10 ) << r.smoothed_us << std::setw( 10 ) << r.last_us
+		    << std::setw( 10 ) << r.max_us << std::setw( 8 ) << r.outstanding.size() << std::setw( 10 ) << r.unmatched << '\n';
+	}
+}
@@ -0,0 +1,66 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	Passive round trip monitor for one Room. Game data (0x4b0) is relayed
+	host -> every player and player -> host, and the receiving game sends
+	0x456 "data received" back the same way. Pairing each relayed frame
+	with the next acknowledgement of its receiver gives the application
+	level round trip through the server: the receiver's downlink, its
+	processing time and its uplink back to the server. A slow player shows
+	a high round trip of its own; a slow host uplink (or a busy host PC)
+	shows as a high round trip of the host, which acknowledges the frames
+	of all players, and as a growing number of unacknowledged frames.
+
+	0x460 "end of transmission" is taken as acknowledgement of everything
+	the sender still has outstanding.
+
+	Frames are matched first in, first out. If a receiver never
+	acknowledges, its oldest frames are dropped beyond max_outstanding and
+	counted as unmatched, so a wrong pairing shows instead of skewing the
+	figures.
+*/
+class RelayLag
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum { max_outstanding = 256 };
+
+	//a game data frame was queued for receiver_id
+	void sent( unsigned int receiver_id, Clock::time_point now );
+	//0x456 from receiver_id acknowledges its oldest outstanding frame
+	void acknowledged( unsigned int receiver_id, Clock::time_point now );
+	//0x460 from receiver_id acknowledges all its outstanding frames
+	void completed( unsigned int receiver_id, Clock::time_point now );
+	//the player left the room
+	void forget( unsigned int receiver_id ) { m_receivers.erase( receiver_id ); };
+
+	bool empty() const { return m_receivers.empty(); };
+
+	//one line per receiver, host_id is marked; name_of returns the player name
+	void print( std::ostream& out, unsigned int host_id, const std::function<std::string( unsigned int )>& name_of ) const;
+
+private:
+	struct Receiver
+	{
+		Receiver() : samples( 0 ), unmatched( 0 ), smoothed_us( 0 ), last_us( 0 ), max_us( 0 ) {};
+
+		std::deque<Clock::time_point> outstanding;
+		unsigned long long samples;
+		unsigned long long unmatched;
+		long long smoothed_us;//moving average over about 8 samples, like TCP's SRTT
+		long long last_us;
+		long long max_us;
+	};
+
+	static void sample( Receiver& r, Clock::time_point sent, Clock::time_point now );
+
+	std::map<unsigned int, Receiver> m_receivers;
+};
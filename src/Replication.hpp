@@ -0,0 +1,48 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	Lobby state as replicated between servers (see Federation class).
+	A Replica holds the local Players and Rooms of one partition, keyed
+	by the IDs of the server which owns them.
+*/
+struct ReplicatedPlayer
+{
+	std::string   name;
+	std::string   props;
+	unsigned char status;
+	unsigned char announced_status;
+
+	bool operator ==( const ReplicatedPlayer& o ) const
+	{
+		return status == o.status && announced_status == o.announced_status && name == o.name && props == o.props;
+	};
+	bool operator !=( const ReplicatedPlayer& o ) const { return !( *this == o ); };
+};
+
+struct ReplicatedRoom
+{
+	std::string               desc;
+	std::string               info;
+	unsigned int              magic;
+	bool                      hidden;
+	std::vector<unsigned int> players;//host first
+
+	bool operator ==( const ReplicatedRoom& o ) const
+	{
+		return magic == o.magic && hidden == o.hidden && desc == o.desc && info == o.info && players == o.players;
+	};
+	bool operator !=( const ReplicatedRoom& o ) const { return !( *this == o ); };
+};
+
+struct Replica
+{
+	std::map<unsigned int, ReplicatedPlayer> players;//key: Client ID
+	std::map<unsigned int, ReplicatedRoom>   rooms;  //key: room host Client ID
+};
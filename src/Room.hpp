@@ -7,13 +7,27 @@
 #pragma once
 #include "Precompiled.hpp"
 
+#include "Interned.hpp"
+#include "RelayLag.hpp"
+#include "Trace.hpp"
+
 
 /*
 	Room class stores room data which must be presented to newcomers, and a
 	hidden status for started games which must not be shown in 0x19b.
 
 	Stores separate host ID for easier lookup, and all player IDs (host
-	included as 1st entry) in a vector for easy iteration.
+	included as 1st entry) in a vector for easy iteration. The info string
+	takes few distinct values and is Interned.
+
+	Round trips of the game data relayed in the room are measured by its
+	RelayLag, which is not part of the hot restart state.
+
+	The room properties the host last sent in 0x0c9 are kept to answer
+	the 0x0c9 requests of other players without the host (see
+	Lobby::process_buf()). They list the members and the room info, so
+	every change of the room drops them. Not part of the hot restart
+	state either, the next reply of the host restores them.
 */
 class Room
 {
@@ -21,24 +35,38 @@ private:
 	typedef std::vector<unsigned int> IdVector;
 
 public:
-	Room( int host_id, const std::string& description ) :
-		m_host_id( host_id ), m_description( description ), m_info( "0" ), m_hidden( false )
+	Room( int host_id, const std::string& description, unsigned int magic ) :
+		m_description( description ), m_info( "0" ), m_host_id( host_id ), m_magic( magic ), m_hidden( false ), m_remote( false )
 	{ m_players.reserve( 8 ); };
 	
 	unsigned int           host_id() const { return m_host_id;     };
+	unsigned int             magic() const { return m_magic;       };
 	const IdVector&        players() const { return m_players;     };
 	const std::string& description() const { return m_description; };
-	const std::string&        info() const { return m_info;        };
+	const std::string&        info() const { return m_info.str();  };
+
+	void set_info( const std::string& s ) { if ( s != m_info.str() ) { m_info = Interned( s ); drop_props(); } };
+	void set_new_host ( unsigned int id ) { m_host_id = id; drop_props(); };
+	void    add_player( unsigned int id ) { m_players.push_back( id ); drop_props(); };
+	void remove_player( unsigned int id ) { m_players.erase( std::remove( m_players.begin(), m_players.end(), id ), m_players.end() ); m_lag.forget( id ); drop_props(); };
+	void   set_players( const IdVector& ids ) { m_players = ids; drop_props(); };
+
+	//0x0c9 data of the host, empty if unknown or outdated
+	const std::string& props() const { return m_props; };
+	void set_props( const std::string& props ) { m_props = props; };
+	void drop_props() { m_props.clear(); };
 
-	void set_info( const std::string& s ) { m_info    =  s; };
-	void set_new_host ( unsigned int id ) { m_host_id = id; };
-	void    add_player( unsigned int id ) { m_players.push_back( id ); };
-	void remove_player( unsigned int id ) { m_players.erase( std::remove( m_players.begin(), m_players.end(), id ), m_players.end() ); };
+	//rooms replicated from another server can be seen, but not joined
+	bool is_remote() const { return m_remote; };
+	void set_remote()      { m_remote = true; };
 
 	//used in 0x19b response to hide started games
 	//(players which already are in lobby get the start game notification)
 	bool is_hidden() const { return m_hidden; };
-	void hide_from_lobby() { m_hidden = true; };
+	void hide_from_lobby() { m_hidden = true; drop_props(); };
+
+	RelayLag&       lag()       { return m_lag; };
+	const RelayLag& lag() const { return m_lag; };
 
 private:
 	/* Room state explanations:
@@ -55,8 +83,14 @@ private:
 	    6) unknown / 0
 	*/
 	const std::string m_description;
-	unsigned int m_host_id;
-	std::string  m_info;
+	Interned     m_info;
 	IdVector     m_players;
+	unsigned int m_host_id;
+	unsigned int m_magic;//unknown int from 0x19c, repeated in 0x19d
 	bool         m_hidden;
+	bool         m_remote;
+	RelayLag     m_lag;
+	std::string  m_props;
+
+	Trace<Room> m_trace;
 };
@@ -0,0 +1,129 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#ifdef SERVER_THREADS
+#include <mutex>
+#endif
+
+#include "Admission.hpp"
+#include "SendBuffer.hpp"
+
+//64 bytes, 128 bytes, ... max_block_size
+static const unsigned int size_classes = 16;
+static_assert( SendBuffer::min_block_size << ( size_classes - 1 ) == SendBuffer::max_block_size, "size classes" );
+
+static std::vector<void*> s_free[size_classes];
+#ifdef SERVER_THREADS
+static std::mutex s_free_mutex;
+#endif
+
+static size_t block_size( unsigned int size_class )
+{
+	return static_cast<size_t>( SendBuffer::min_block_size ) << size_class;
+}
+
+
+BufPtr SendBuffer::create( const unsigned char* data, size_t size )
+{
+	auto buf = allocate( size, false );
+	if ( size ) std::memcpy( buf->raw(), data, size );
+	return BufPtr( buf );
+}
+
+
+BufPtr SendBuffer::create_stream( size_t size )
+{
+	return BufPtr( allocate( size, true ) );
+}
+
+
+/*
+	Takes a block of the smallest fitting size class, from the free list
+	if possible. Placement new keeps header and data in the same block.
+*/
+SendBuffer* SendBuffer::allocate( size_t size, bool stream )
+{
+	const size_t needed = sizeof( SendBuffer ) + size;
+	unsigned int size_class = 0;
+	while ( size_classes > size_class && block_size( size_class ) < needed ) ++size_class;
+
+	void* block = nullptr;
+	if ( size_classes > size_class )
+	{
+#ifdef SERVER_THREADS
+		std::lock_guard<std::mutex> lock( s_free_mutex );
+#endif
+		auto& free = s_free[size_class];
+		if ( !free.empty() )
+		{
+			block = free.back();
+			free.pop_back();
+			Trace<PooledSendBuffer>::sub_bytes( block_size( size_class ) );
+		}
+	}
+	if ( !block ) block = ::operator new( size_classes > size_class ? block_size( size_class ) : needed );
+
+	return new ( block ) SendBuffer( size, size_class, stream );
+}
+
+
+SendBuffer::SendBuffer( size_t size, unsigned int size_class, bool stream ) :
+	m_refs      ( 1 ),
+	m_size      ( size ),
+	m_filled    ( stream ? 0 : size ),
+	m_size_class( size_class ),
+	m_stream    ( stream ),
+	m_admission ( nullptr )
+{
+	Trace<SendBuffer>::add_bytes( m_size );
+}
+
+
+SendBuffer::~SendBuffer()
+{
+	Trace<SendBuffer>::sub_bytes( m_size );
+}
+
+
+void SendBuffer::charge( Admission& admission ) const
+{
+	if ( m_admission ) return;
+	m_admission = &admission;
+	admission.charge( m_size );
+}
+
+
+/*
+	Destroys the buffer with the last reference and returns its block to
+	the free list, unless the list already holds max_pooled_bytes. A
+	charged buffer is refunded to Admission.
+*/
+void SendBuffer::release()
+{
+	if ( 0 != --m_refs ) return;
+	if ( m_admission ) m_admission->refund( m_size );
+
+	const auto size_class = m_size_class;
+	this->~SendBuffer();
+	void* block = this;
+
+	if ( size_classes > size_class )
+	{
+#ifdef SERVER_THREADS
+		std::lock_guard<std::mutex> lock( s_free_mutex );
+#endif
+		auto& free = s_free[size_class];
+		if ( ( free.size() + 1 ) * block_size( size_class ) <= max_pooled_bytes )
+		{
+			free.push_back( block );
+			Trace<PooledSendBuffer>::add_bytes( block_size( size_class ) );
+			return;
+		}
+	}
+	::operator delete( block );
+}
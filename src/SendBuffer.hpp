@@ -0,0 +1,124 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "Trace.hpp"
+
+class Admission;
+class BufPtr;
+
+//accounting tag for free send buffer blocks kept by the pool (see Trace.cpp)
+struct PooledSendBuffer;
+
+/*
+	A send buffer as allocated by Lobby::send(). It is handed out as BufPtr
+	and shared between the queues of all targeted Sessions.
+
+	Header and data live in one block taken from a free list per size
+	class (powers of two from min_block_size to max_block_size). When the
+	last BufPtr goes away (the last Session pop'ed it from its queue), the
+	block returns to its free list, up to max_pooled_bytes per class.
+	Bigger buffers are allocated and freed directly.
+
+	Big 0x4b0 frames are forwarded while they are still being received
+	(see Session::open_stream()). Such a stream buffer is queued when only
+	the header is known, filled() tells how much of it can be sent.
+
+	A buffer is charged to the Admission budget when it is first queued
+	and refunded when the last reference goes away, so a map broadcast
+	to a room counts once, not once per player.
+
+	The reference count is a plain integer: the event loop runs on one
+	thread. Compile with SERVER_THREADS defined to make the count atomic
+	and the free lists locked if it ever runs on several threads.
+*/
+class SendBuffer
+{
+public:
+	//copies size bytes of data into a new buffer
+	static BufPtr create( const unsigned char* data, size_t size );
+	//size bytes, to be filled by the creator through fill_pos() and fill()
+	static BufPtr create_stream( size_t size );
+
+	const unsigned char* data() const { return reinterpret_cast<const unsigned char*>( this + 1 ); };
+	size_t               size() const { return m_size; };
+	unsigned char operator[]( size_t i ) const { return data()[i]; };
+
+	size_t   filled() const { return m_filled;           };
+	bool   complete() const { return m_filled == m_size; };
+	bool  is_stream() const { return m_stream;           };
+
+	unsigned char* fill_pos() { return raw() + m_filled; };
+	void fill( size_t n ) { m_filled += n; };
+
+	//charges size() to admission unless already charged (see Session::enqueue())
+	void charge( Admission& admission ) const;
+
+	SendBuffer( const SendBuffer& ) = delete;
+	SendBuffer& operator =( const SendBuffer& ) = delete;
+
+	enum { min_block_size   = 0x40     };//64 bytes
+	enum { max_block_size   = 0x200000 };//2 MiB, fits max_packet_size with header
+	enum { max_pooled_bytes = 0x400000 };//4 MiB of free blocks per size class
+
+private:
+	friend class BufPtr;
+
+	SendBuffer( size_t size, unsigned int size_class, bool stream );
+	static SendBuffer* allocate( size_t size, bool stream );
+	~SendBuffer();
+
+	void add_ref() { ++m_refs; };
+	void release();
+
+	unsigned char* raw() { return reinterpret_cast<unsigned char*>( this + 1 ); };
+
+#ifdef SERVER_THREADS
+	std::atomic<unsigned int> m_refs;
+#else
+	unsigned int              m_refs;
+#endif
+	const size_t       m_size;
+	size_t             m_filled;
+	const unsigned int m_size_class;//size_classes: not pooled
+	const bool         m_stream;
+	mutable Admission* m_admission;//charged to, refunded on release()
+
+	Trace<SendBuffer> t;
+};
+
+
+/*
+	Shared ownership of a SendBuffer, like std::shared_ptr but without
+	a separate control block.
+*/
+class BufPtr
+{
+public:
+	BufPtr() : m_p( nullptr ) {};
+	BufPtr( const BufPtr& other ) : m_p( other.m_p ) { if ( m_p ) m_p->add_ref(); };
+	BufPtr( BufPtr&& other ) : m_p( other.m_p ) { other.m_p = nullptr; };
+	~BufPtr() { if ( m_p ) m_p->release(); };
+
+	BufPtr& operator =( BufPtr other ) { std::swap( m_p, other.m_p ); return *this; };
+
+	const SendBuffer* get()         const { return m_p;  };
+	const SendBuffer* operator ->() const { return m_p;  };
+	const SendBuffer& operator * () const { return *m_p; };
+	explicit operator bool()        const { return nullptr != m_p; };
+
+	//for the creator of a stream buffer only
+	SendBuffer* writable() const { return m_p; };
+
+private:
+	friend class SendBuffer;
+	//takes over the initial reference
+	explicit BufPtr( SendBuffer* p ) : m_p( p ) {};
+
+	SendBuffer* m_p;
+};
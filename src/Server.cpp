@@ -6,19 +6,67 @@
 */
 #include "Precompiled.hpp"
 
+#include "FlightRecorder.hpp"
 #include "Server.hpp"
 #include "Session.hpp"
+#include "Trace.hpp"
 
 using namespace asio::ip;
 
 /*
 	Creates Asio TCP acceptor (default on port 31523), starts recursive
-	asynchronous connection acceptor.
+	asynchronous connection acceptor and the signal listener. Links to
+	other servers if federation options are given. With --handoff, takes
+	over from a running server first (see Handoff class). With --admin,
+	opens the operator console (see AdminConsole class).
 */
-Server::Server( asio::io_service& io_service ) :
-	m_acceptor( io_service, tcp::endpoint( tcp::v4(), port ) ),
-	m_socket  ( io_service )
+Server::Server( asio::io_service& io_service, const Options& options ) :
+	m_io_service ( io_service ),
+	m_options    ( options ),
+	m_timers     ( io_service ),
+	m_admission  ( m_options ),
+	m_tcp_monitor( io_service, m_timers, m_options.tcp_sample ),
+	m_loop_monitor( io_service ),
+	m_acceptor   ( io_service ),
+	m_socket     ( io_service ),
+	m_signals    ( io_service ),
+	m_partitions ( io_service, m_options.coalesce_ms ),
+	m_stats      ( m_timers, m_partitions, m_options.stats_shm ),
+	m_handing_off( false )
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	,
+	m_handoff_acceptor( io_service ),
+	m_handoff_socket  ( io_service )
+#endif
 {
+#ifdef SIGUSR1
+	m_signals.add( SIGUSR1 );//dump flight recorder
+	m_signals.add( SIGUSR2 );//print object and memory accounting
+	do_await_signal();
+#endif
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	if ( !options.handoff.empty() ) take_over( options.handoff );
+#else
+	if ( !options.handoff.empty() ) std::cerr << "[WARNING] --handoff is not supported on this platform\n";
+#endif
+	if ( !m_acceptor.is_open() )
+	{
+		const tcp::endpoint ep( tcp::v4(), options.port );
+		m_acceptor.open( ep.protocol() );
+		m_acceptor.set_option( tcp::acceptor::reuse_address( true ) );
+		m_acceptor.bind( ep );
+		m_acceptor.listen();
+	}
+	if ( 0 != options.federation_port || !options.peers.empty() )
+	{
+		m_federation.reset( new Federation( io_service, m_partitions, options ) );
+	}
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	if ( !options.handoff.empty() ) listen_for_handoff( options.handoff );
+	if ( !options.admin.empty() ) m_admin.reset( new AdminConsole( io_service, m_partitions, options.admin ) );
+#else
+	if ( !options.admin.empty() ) std::cerr << "[WARNING] --admin is not supported on this platform\n";
+#endif
 	do_accept();
 }
 
@@ -26,6 +74,7 @@ Server::Server( asio::io_service& io_service ) :
 /*
 	Recursive asynchronous connection acceptor. For details see
 	https://github.com/chriskohlhoff/asio/tree/master/asio/src/examples
+	Connections refused by Admission are closed right away.
 */
 void Server::do_accept()
 {
@@ -34,14 +83,219 @@ void Server::do_accept()
 	{
 		if ( !ec )
 		{
-			std::cout << "Client connected:    " << std::setfill(' ') << std::setw(15) << std::right
-			          << m_socket.remote_endpoint().address().to_string() << std::endl;
-			std::make_shared<Session>( std::move( m_socket ), m_lobby )->start();
+			asio::error_code ep_ec;
+			const auto ep = m_socket.remote_endpoint( ep_ec );
+			const auto address = ep_ec ? "?" : ep.address().to_string();
+			if ( m_admission.admit( address, Session::initial_buffer_size ) )
+			{
+				std::cout << "Client connected:    " << std::setfill(' ') << std::setw(15) << std::right
+				          << address << std::endl;
+				std::make_shared<Session>( std::move( m_socket ), m_partitions, m_timers, m_admission, m_tcp_monitor, m_options )->start();
+			}
+			else
+			{
+				m_socket.close( ep_ec );
+			}
 		}
-		else
+		else if ( !m_handing_off )
 		{
 			std::cerr << "[ERROR] Could not accept connection: " << ec << "\n";
 		}
-		do_accept();
+		if ( !m_handing_off ) do_accept();
+	} );
+}
+
+
+/*
+	Recursive asynchronous signal listener. SIGUSR1 writes the packet
+	flight recorder to disk (see FlightRecorder class for details),
+	SIGUSR2 prints live object counts, memory usage, admission counters,
+	event loop lag and send queues.
+*/
+void Server::do_await_signal()
+{
+	m_signals.async_wait(
+	[this]( std::error_code ec, int signal_number )
+	{
+		if ( ec ) return;//signal set was cancelled
+#ifdef SIGUSR1
+		if ( SIGUSR1 == signal_number )
+		{
+			FlightRecorder::dump( "SIGUSR1", true );
+		}
+		else if ( SIGUSR2 == signal_number )
+		{
+			print_trace_report( std::cout );
+			m_admission.print( std::cout );
+			Session::print_failure_detection( std::cout );
+			Session::print_queue_delay( std::cout );
+			LoopMonitor::print( std::cout );
+			ZeroCopy::print( std::cout );
+			HandlerMemory::print( std::cout );
+			Lobby::print_lookup_misses( std::cout );
+			Lobby::print_props_cache( std::cout );
+			m_partitions.print_clients( std::cout );
+		}
+#endif
+		do_await_signal();
+	} );
+}
+
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+
+/*
+	Connects to the server listening on path and takes over its client
+	acceptor, lobby state and Sessions. Returns without doing anything if
+	no server listens there. Throws if the transfer breaks off, the old
+	server then resumes on its own.
+*/
+void Server::take_over( const std::string& path )
+{
+	const int fd = Handoff::connect( path );
+	if ( -1 == fd ) return;
+
+	const auto start = std::chrono::steady_clock::now();
+	//closes the connection when done
+	asio::local::stream_protocol::socket channel( m_io_service );
+	channel.assign( asio::local::stream_protocol(), fd );
+
+	Handoff handoff( fd );
+	std::vector<std::shared_ptr<Session>> sessions;
+	Buffer buf;
+	int received_fd = -1;
+	for ( ;; )
+	{
+		handoff.receive( buf, received_fd );
+		Packet p( buf, 0 );
+		if      ( Handoff::Done         == p.cmd() ) break;
+		else if ( Handoff::Listener     == p.cmd() )
+		{
+			m_acceptor.assign( tcp::v4(), received_fd );
+		}
+		else if ( Handoff::SessionState == p.cmd() )
+		{
+			tcp::socket socket( m_io_service );
+			socket.assign( tcp::v4(), received_fd );
+			auto session = std::make_shared<Session>( std::move( socket ), m_partitions, m_timers, m_admission, m_tcp_monitor, m_options );
+			m_admission.enter( session->address(), Session::initial_buffer_size );
+			const auto key = session->restore( p );
+			m_partitions.adopt( session, key );
+			sessions.push_back( session );
+		}
+		else
+		{
+			m_partitions.restore( p );
+		}
+	}
+	handoff.send_ack();
+
+	for ( const auto& session : sessions ) session->resume();
+
+	const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start ).count();
+	std::cout << "Took over " << sessions.size() << " clients in " << ms << " ms" << std::endl;
+}
+
+
+/*
+	Listens on path for the next server process. A stale socket file
+	left by a crashed server is replaced, any other file is left alone
+	and fails the startup.
+*/
+void Server::listen_for_handoff( const std::string& path )
+{
+	Handoff::remove_stale_socket( path );
+	const asio::local::stream_protocol::endpoint ep( path );
+	m_handoff_acceptor.open( ep.protocol() );
+	m_handoff_acceptor.bind( ep );
+	m_handoff_acceptor.listen();
+	do_await_handoff();
+}
+
+
+void Server::do_await_handoff()
+{
+	m_handoff_acceptor.async_accept( m_handoff_socket,
+	[this]( std::error_code ec )
+	{
+		if ( ec ) return;
+		hand_off();
 	} );
 }
+
+
+/*
+	A new server process connected: stops accepting, closes federation
+	links and suspends all Sessions. The transfer starts once every
+	Session has no read or write pending (see await_suspended()).
+*/
+void Server::hand_off()
+{
+	std::cout << "Handing off to new server process..." << std::endl;
+	m_handing_off   = true;
+	m_handoff_start = std::chrono::steady_clock::now();
+
+	asio::error_code ec;
+	m_acceptor.cancel( ec );
+	if ( m_federation ) m_federation->stop();
+	m_partitions.suspend();
+	await_suspended();
+}
+
+
+/*
+	Polls through the io_service until all cancelled operations finished,
+	then sends everything and stops the io_service, which ends the process.
+*/
+void Server::await_suspended()
+{
+	const auto elapsed = std::chrono::steady_clock::now() - m_handoff_start;
+	if ( !m_partitions.suspended() )
+	{
+		if ( std::chrono::milliseconds( Handoff::max_suspend_ms ) < elapsed )
+		{
+			abort_hand_off( "Sessions could not be suspended" );
+			return;
+		}
+		m_partitions.suspend();
+		m_io_service.post( [this]() { await_suspended(); } );
+		return;
+	}
+
+	try
+	{
+		Handoff handoff( m_handoff_socket.native_handle(), m_handoff_start + std::chrono::milliseconds( Handoff::max_suspend_ms ) );
+		handoff.send( Handoff::Listener, 0, m_acceptor.native_handle() );
+		m_partitions.save( handoff );
+		handoff.send( Handoff::Done );
+		if ( !handoff.receive_ack() ) throw std::runtime_error( "no acknowledgement" );
+	}
+	catch ( const std::exception& e )
+	{
+		abort_hand_off( e.what() );
+		return;
+	}
+
+	const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - m_handoff_start ).count();
+	std::cout << "Handoff completed in " << ms << " ms, exiting" << std::endl;
+	m_io_service.stop();
+}
+
+
+/*
+	Resumes normal operation after a failed handoff.
+*/
+void Server::abort_hand_off( const std::string& reason )
+{
+	std::cerr << "[ERROR] Handoff failed: " << reason << ", resuming\n";
+	asio::error_code ec;
+	m_handoff_socket.close( ec );
+
+	m_handing_off = false;
+	m_partitions.resume();
+	if ( m_federation ) m_federation->start();
+	do_accept();
+	do_await_handoff();
+}
+
+#endif
@@ -7,22 +7,56 @@
 #pragma once
 #include "Precompiled.hpp"
 
+#include "AdminConsole.hpp"
+#include "Federation.hpp"
+#include "Handoff.hpp"
+#include "LoopMonitor.hpp"
+#include "Options.hpp"
 #include "Session.hpp"
+#include "StatsSegment.hpp"
 
 using namespace asio::ip;
 
-//TCP port to listen on (default 31523)
-const unsigned short port = 31523;
-
 class Server
 {
 public:
-	Server( asio::io_service& io_service );
+	Server( asio::io_service& io_service, const Options& options );
 
 private:
 	void do_accept();
+	void do_await_signal();
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	//hot restart, see Handoff class
+	void take_over         ( const std::string& path );
+	void listen_for_handoff( const std::string& path );
+	void do_await_handoff();
+	void hand_off();
+	void await_suspended();
+	void abort_hand_off( const std::string& reason );
+#endif
+
+	asio::io_service& m_io_service;
+	const Options     m_options;
+	TimerWheel        m_timers;//Session deadlines
+	Admission         m_admission;//outlives all Sessions
+	TcpMonitor        m_tcp_monitor;//outlives all Sessions
+	LoopMonitor       m_loop_monitor;
+	tcp::acceptor     m_acceptor;
+	tcp::socket       m_socket;
+	asio::signal_set  m_signals;
+	Partitions        m_partitions;
+	StatsSegment      m_stats;//only with --stats-shm
+
+	//only with --federation-port or --peer
+	std::unique_ptr<Federation> m_federation;
+
+	bool m_handing_off;
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	std::unique_ptr<AdminConsole> m_admin;//only with --admin
 
-	tcp::acceptor m_acceptor;
-	tcp::socket   m_socket;
-	Lobby         m_lobby;
+	asio::local::stream_protocol::acceptor m_handoff_acceptor;
+	asio::local::stream_protocol::socket   m_handoff_socket;
+	std::chrono::steady_clock::time_point  m_handoff_start;
+#endif
 };
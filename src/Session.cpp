@@ -6,32 +6,284 @@
 */
 #include "Precompiled.hpp"
 
+#ifdef __linux__
+#include <netinet/tcp.h>
+#endif
+
+#include "FlightRecorder.hpp"
+#include "Handoff.hpp"
+#include "LoopMonitor.hpp"
+#include "SendBuffer.hpp"
 #include "Session.hpp"
+#include "StatsSegment.hpp"
 
 using namespace asio::ip;
 
+//detection latency of failed in-game connections, see Session::close()
+static unsigned long long s_failures    = 0;
+static long long          s_latency_sum = 0;//ms
+static long long          s_latency_max = 0;//ms
+static long long          s_latency_last = 0;//ms
+
+//queueing delay per Client::Lane, see Session::do_send_buf()
+static unsigned long long s_lane_sends[Client::lane_count]    = {};
+static long long          s_lane_delay_sum[Client::lane_count] = {};//us
+static long long          s_lane_delay_max[Client::lane_count] = {};//us
+
 /*
-	Creates local Session buffer with max_packet_size bytes,
-	obtains Asio socket, stores Lobby reference.
+	Creates local Session buffer with initial_buffer_size bytes,
+	obtains Asio socket, stores Partitions reference, registers the
+	socket with the TcpMonitor. Nagle's algorithm is turned off for the
+	send lanes, see class comment.
 */
-Session::Session( tcp::socket socket, Lobby& lobby ) :
-	m_buf   ( max_packet_size ),
-	m_socket( std::move( socket ) ),
-	m_lobby ( lobby )
+Session::Session( tcp::socket socket, Partitions& partitions, TimerWheel& timers, Admission& admission, TcpMonitor& tcp_monitor, const Options& options ) :
+	m_socket        ( std::move( socket ) ),
+	m_tcp_probe     ( tcp_monitor, m_socket ),
+	m_partitions    ( partitions ),
+	m_buf           ( initial_buffer_size ),
+	m_buf_accounted ( initial_buffer_size ),
+	m_closed        ( false ),
+	m_admission     ( admission ),
+	m_read_retry    ( [this]() { if ( !m_closed && !m_suspended && !m_reading ) do_read( shared_from_this() ); } ),
+	m_timers        ( timers ),
+	m_options       ( options ),
+	m_deadline_check( [this]() { check_deadlines(); } ),
+	m_connected     ( timers.now() ),
+	m_last_read     ( m_connected ),
+	m_last_sent     ( m_connected ),
+	m_send_lane     ( LobbyLane ),
+	m_queued_bytes  ( 0 ),
+	m_read_bytes    ( 0 ),
+	m_send_offset   ( 0 ),
+	m_reading       ( false ),
+	m_writing       ( false ),
+	m_suspended     ( false ),
+	m_in_game       ( false ),
+	m_zerocopy      ( options.zerocopy_min ),
+	m_zc_waiting    ( false )
 {
 	//store IP address as string for easier output
-	m_client_address = m_socket.remote_endpoint().address().to_string();
+	asio::error_code ec;
+	const auto ep = m_socket.remote_endpoint( ec );
+	m_client_address = ec ? "?" : ep.address().to_string();
+	m_socket.set_option( tcp::no_delay( true ), ec );
+	Trace<Session>::add_bytes( m_buf_accounted );
+}
+
+
+/*
+	Releases the byte accounting for the receive buffer and for
+	anything still left in the send queue, frees the admission slot.
+	Queued buffers are refunded to Admission by the last queue holding
+	them (see SendBuffer::charge()).
+*/
+Session::~Session()
+{
+	Trace<Session>   ::sub_bytes( m_buf_accounted );
+	Trace<QueuedSend>::sub_bytes( m_queued_bytes );
+	m_admission.refund( m_buf_accounted );
+	m_admission.leave( m_client_address );
 }
 
 
 /*
 	Passes Client interface of own instance to Lobby, starts
-	recursive packet reading.
+	recursive packet reading and the deadline checks.
 */
 void Session::start()
 {
-	m_lobby.connect( shared_from_this() );
-	do_read_header();
+	m_partitions.connect( shared_from_this() );
+	schedule_deadline_check();
+	do_read( shared_from_this() );
+}
+
+
+/*
+	Reports the disconnect to Partitions (and so to Lobby) exactly once,
+	no matter how many pending operations fail afterwards.
+*/
+void Session::close( bool failed )
+{
+	if ( m_closed ) return;
+	m_closed = true;
+	if ( m_stream ) close_stream( false );
+	asio::error_code ec;
+	//zero copy buffers are released with the Session, a reset makes the
+	//kernel drop its references to them right away
+	if ( m_zerocopy.pending() ) m_socket.set_option( asio::socket_base::linger( true, 0 ), ec );
+	if ( failed && m_in_game )
+	{
+		using namespace std::chrono;
+		const long long ms = duration_cast<milliseconds>( steady_clock::now() - m_last_read ).count();
+		++s_failures;
+		s_latency_sum += ms;
+		s_latency_max  = std::max( s_latency_max, ms );
+		s_latency_last = ms;
+		std::cerr << "[WARNING] Lost in-game connection to " << m_client_address
+		          << ", detected " << ms << " ms after the last received data\n";
+	}
+	m_deadline_check.cancel();
+	m_read_retry.cancel();
+	m_partitions.disconnect( shared_from_this() );
+	m_socket.close( ec );
+}
+
+
+/*
+	Closes the connection if
+	  - the client did not log in within login_timeout
+	  - nothing was received for idle_timeout
+	  - the send queue did not make progress for send_timeout, which
+	    also detects half-open connections whose peer vanished
+	Deadlines are checked lazily: reads and writes only record the time,
+	the check runs at the earliest time a deadline can be missed.
+*/
+void Session::check_deadlines()
+{
+	if ( m_closed ) return;
+	auto self( shared_from_this() );
+	const auto now = m_timers.now();
+	const auto s   = []( unsigned int seconds ) { return std::chrono::seconds( seconds ); };
+	//a stream buffer which was sent as far as it arrived is not stalled
+	const auto& lane = m_lanes[m_send_lane];
+	const bool waiting_for_stream = !lane.empty() && !m_writing
+	                                && m_send_offset == lane.front().buf->filled() && !lane.front().buf->complete();
+
+	std::string reason;
+	if ( m_suspended )
+	{
+		//hot restart in progress
+	}
+	else if ( m_options.login_timeout && !m_partitions.logged_in( m_client_id )
+	          && s( m_options.login_timeout ) <= now - m_connected )
+	{
+		reason = "no login";
+	}
+	else if ( m_options.idle_timeout && s( m_options.idle_timeout ) <= now - m_last_read )
+	{
+		reason = "idle";
+	}
+	else if ( m_in_game && m_options.game_timeout && !queue_empty() && !waiting_for_stream
+	          && s( m_options.game_timeout ) <= now - m_last_sent )
+	{
+		reason = "in-game send stalled with " + std::to_string( m_queued_bytes ) + " bytes queued";
+	}
+	else if ( m_options.send_timeout && !queue_empty() && !waiting_for_stream
+	          && s( m_options.send_timeout ) <= now - m_last_sent )
+	{
+		reason = "send stalled with " + std::to_string( m_queued_bytes ) + " bytes queued";
+	}
+
+	if ( reason.empty() )
+	{
+		schedule_deadline_check();
+		return;
+	}
+	std::cerr << "[WARNING] Closing connection to " << m_client_address << ": " << reason << "\n";
+	close( true );
+}
+
+
+void Session::schedule_deadline_check()
+{
+	using namespace std::chrono;
+	const auto now  = m_timers.now();
+	auto next = steady_clock::duration::max();
+
+	if ( m_options.login_timeout && !m_partitions.logged_in( m_client_id ) )
+	{
+		next = std::min( next, m_connected + seconds( m_options.login_timeout ) - now );
+	}
+	if ( m_options.idle_timeout )
+	{
+		next = std::min( next, m_last_read + seconds( m_options.idle_timeout ) - now );
+	}
+	if ( m_options.send_timeout )
+	{
+		//the queue can start stalling any time, check at this interval
+		next = std::min<steady_clock::duration>( next, seconds( m_options.send_timeout ) );
+	}
+	if ( m_in_game && m_options.game_timeout )
+	{
+		next = std::min<steady_clock::duration>( next, seconds( keepalive_interval ) );
+	}
+	if ( steady_clock::duration::max() == next ) return;
+
+	m_timers.schedule( m_deadline_check, duration_cast<milliseconds>( std::max( next, steady_clock::duration::zero() ) ) );
+}
+
+
+void Session::kick()
+{
+	std::cout << "Client kicked:       " << std::setfill(' ') << std::setw(15) << std::right
+	          << m_client_address << std::endl;
+	close();
+}
+
+
+/*
+	Switches between the default liveness settings and the aggressive
+	ones for players in a running game. The send lanes depend on the
+	game state as well (see queue_buf()), so it is tracked even if
+	--game-timeout 0 leaves the liveness settings alone.
+*/
+void Session::set_in_game( bool in_game )
+{
+	if ( m_in_game == in_game ) return;
+	m_in_game = in_game;
+	if ( !m_options.game_timeout ) return;
+	apply_liveness_options();
+	if ( !m_closed && !m_suspended ) schedule_deadline_check();
+}
+
+
+/*
+	Keepalive probes start after keepalive_interval seconds without
+	traffic. The TCP user timeout limits how long sent data or probes may
+	stay unacknowledged, the kernel then fails the connection and the
+	pending read reports the error. Both are Linux specific, elsewhere
+	only plain keepalive and the send queue check apply.
+*/
+void Session::apply_liveness_options()
+{
+	asio::error_code ec;
+	m_socket.set_option( asio::socket_base::keep_alive( m_in_game ), ec );
+#if defined( TCP_KEEPIDLE ) && defined( TCP_USER_TIMEOUT )
+	const int fd       = m_socket.native_handle();
+	const int interval = keepalive_interval;
+	const int count    = static_cast<int>( m_options.game_timeout );
+	const unsigned int user_timeout = m_in_game ? m_options.game_timeout * 1000 : 0;//ms, 0: system default
+	::setsockopt( fd, IPPROTO_TCP, TCP_KEEPIDLE,     &interval,     sizeof( interval ) );
+	::setsockopt( fd, IPPROTO_TCP, TCP_KEEPINTVL,    &interval,     sizeof( interval ) );
+	::setsockopt( fd, IPPROTO_TCP, TCP_KEEPCNT,      &count,        sizeof( count ) );
+	::setsockopt( fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof( user_timeout ) );
+#endif
+}
+
+
+void Session::print_failure_detection( std::ostream& out )
+{
+	out << "in-game connection failures: " << s_failures;
+	if ( s_failures )
+	{
+		out << ", detected after " << s_latency_sum / static_cast<long long>( s_failures ) << " ms on average"
+		    << " (max " << s_latency_max << " ms, last " << s_latency_last << " ms)";
+	}
+	out << "\n";
+}
+
+
+void Session::print_queue_delay( std::ostream& out )
+{
+	const char* names[lane_count] = { "game", "lobby" };
+	out << "send queue delay:";
+	for ( int lane = GameLane; lane_count > lane; ++lane )
+	{
+		const auto n = s_lane_sends[lane];
+		out << ( GameLane == lane ? " " : ", " ) << names[lane] << " lane " << n << " packets";
+		if ( n ) out << ", " << s_lane_delay_sum[lane] / static_cast<long long>( n ) << " us on average (max " << s_lane_delay_max[lane] << " us)";
+	}
+	out << "\n";
 }
 
 
@@ -39,158 +291,524 @@ void Session::start()
 	Pushes recieved shared pointer to local queue, starts recursive
 	packet sending if necessary. The queue will ensure that the buffer
 	will live until the async_write() completes.
+	Outside a game everything takes the lobby lane, see class comment.
 */
-void Session::queue_buf( const BufPtr& buf )
+void Session::queue_buf( const BufPtr& buf, Lane lane )
 {
 #ifndef NDEBUG //display sent packets
-	const auto b = buf.get()->at( 4 );
+	const auto b = (*buf)[4];
 	std::cout << "     " << std::hex << std::setw( 2 ) << std::setfill( ' ' )
-		<< (int) (unsigned char) buf.get()->at( 5 )
-		<< (int) (unsigned char) buf.get()->at( 4 )
+		<< (int) (unsigned char) (*buf)[5]
+		<< (int) (unsigned char) (*buf)[4]
 		<< " --> " << id() << std::endl;
 #endif
 
-	bool queue_is_empty = m_buf_queue.empty();
-	m_buf_queue.push_back( buf );
-	if ( queue_is_empty )
+	bool queue_is_empty = queue_empty();
+	if ( queue_is_empty ) m_last_sent = m_timers.now();
+	enqueue( buf, m_in_game ? lane : LobbyLane );
+	if ( queue_is_empty && !m_suspended )
 	{
-		do_send_buf();
+		do_send_buf( shared_from_this() );
 	}
 }
 
 
+void Session::enqueue( const BufPtr& buf, Lane lane )
+{
+	m_lanes[lane].push_back( Queued{ buf, std::chrono::steady_clock::now() } );
+	m_queued_bytes += buf->size();
+	Trace<QueuedSend>::add_bytes( buf->size() );
+	buf->charge( m_admission );
+}
+
+
+/*
+	Continues sending a stream buffer which waited for more data.
+*/
+void Session::stream_progress()
+{
+	if ( m_writing || m_suspended || m_closed || queue_empty() ) return;
+	m_last_sent = m_timers.now();
+	do_send_buf( shared_from_this() );
+}
+
+
 /*
 	Recursively iterates through queue and calls async_write() on every
 	buffer. The queue element gets pop'ed after the write completes and
 	allows the dynamically allocated buffer to be destroyed (if no other
-	Session queue hold shared ownership to it).
+	Session queue hold shared ownership to it). A write cancelled by
+	suspend() continues at m_send_offset. Stream buffers are written as
+	far as they are filled, the rest follows on stream_progress().
+	Big buffers may go out as zero copy sends, one send call at a time
+	(see ZeroCopy class). The lane is chosen only between buffers.
 */
-void Session::do_send_buf()
+void Session::do_send_buf( std::shared_ptr<Session> self )
 {
-	auto self( shared_from_this() );
-	const auto size = m_buf_queue.front()->size();
-	asio::async_write( m_socket, asio::buffer( m_buf_queue.front().get()->data(), size ),
-	[this, self, size]( asio::error_code ec, std::size_t bytes_sent )
+	if ( 0 == m_send_offset ) m_send_lane = m_lanes[GameLane].empty() ? LobbyLane : GameLane;
+	auto& queued         = m_lanes[m_send_lane].front();
+	const auto& front    = queued.buf;
+	const auto available = front->filled();
+	if ( available == m_send_offset ) return;//stream, waits for more data
+	if ( 0 == m_send_offset && !front->is_stream() )
+	{
+		FlightRecorder::record( FlightRecorder::Out, m_client_id, front->data(), front->size() );
+	}
+	if ( std::chrono::steady_clock::time_point() != queued.since )
+	{
+		using namespace std::chrono;
+		const long long us = duration_cast<microseconds>( steady_clock::now() - queued.since ).count();
+		++s_lane_sends[m_send_lane];
+		s_lane_delay_sum[m_send_lane] += us;
+		s_lane_delay_max[m_send_lane]  = std::max( s_lane_delay_max[m_send_lane], us );
+		queued.since = steady_clock::time_point();
+	}
+	m_writing = true;
+	const auto zerocopy = m_zerocopy.use( static_cast<int>( m_socket.native_handle() ), *front );
+	auto on_sent = make_handler( m_write_memory,
+	[this, self = std::move( self ), zerocopy]( asio::error_code ec, std::size_t bytes_sent ) mutable
 	{
+		m_writing      = false;
+		m_send_offset += bytes_sent;
+		if ( zerocopy )
+		{
+			m_zerocopy.done( bytes_sent );
+			await_zerocopy();
+		}
 		if ( !ec )
 		{
-			if ( size != bytes_sent )
+			m_last_sent = m_timers.now();
+			auto&       lane  = m_lanes[m_send_lane];
+			const auto& front = lane.front().buf;
+			const auto  size  = front->size();
+			if ( size == m_send_offset )
 			{
-				std::cerr << "[WARNING] Malformed packet sent to " << m_client_address << "\n";
+				if ( front->is_stream() )
+				{
+					FlightRecorder::record( FlightRecorder::Out, m_client_id, front->data(), size );
+				}
+				StatsSegment::count_out( front->data()[4] | front->data()[5] << 8, size );
+				lane.pop_front();
+				m_send_offset   = 0;
+				m_queued_bytes -= size;
+				Trace<QueuedSend>::sub_bytes( size );
 			}
-			m_buf_queue.pop_front();
-			if ( !m_buf_queue.empty() )
+			if ( !queue_empty() && !m_suspended && !m_closed )
 			{
-				do_send_buf();
+				do_send_buf( std::move( self ) );
 			}
 		}
-		else
+		else if ( !m_suspended && !m_closed )
 		{
 			std::cerr << "[ERROR] Could not send packet to " << m_client_address << ": " << ec << "\n";
-			m_lobby.disconnect( self );
+			close( true );
 		}
 	} );
+	const auto buffer = asio::buffer( front->data() + m_send_offset, available - m_send_offset );
+	if ( zerocopy )
+	{
+		m_zerocopy.start( front );
+		m_socket.async_send( buffer, ZeroCopy::send_flag, std::move( on_sent ) );
+	}
+	else
+	{
+		asio::async_write( m_socket, buffer, std::move( on_sent ) );
+	}
 }
 
 
 /*
-	Recursively reads packet_header_size bytes, parses first int for data size,
-	proceeds with do_read_body() if necessary. Enforces some sanity checks.
-	Detects disconnection and reports to Lobby for notification purposes.
+	Waits for zero copy completion notifications on the socket error
+	queue while any are outstanding.
 */
-void Session::do_read_header()
+void Session::await_zerocopy()
 {
+	m_zerocopy.reap( static_cast<int>( m_socket.native_handle() ) );
+	if ( m_zc_waiting || !m_zerocopy.pending() || m_suspended || m_closed ) return;
+
 	auto self( shared_from_this() );
-	asio::async_read( m_socket, asio::buffer( m_buf, packet_header_size ),
-	[this, self]( asio::error_code ec, std::size_t bytes_read )
+	m_zc_waiting = true;
+	m_socket.async_wait( tcp::socket::wait_error, make_handler( m_wait_memory,
+	[this, self]( asio::error_code ec )
 	{
-		if ( !ec )
+		m_zc_waiting = false;
+		if ( !ec ) await_zerocopy();
+	} ) );
+}
+
+
+/*
+	Continues with the current frame in m_buf: reads the rest of the header,
+	then the body it announces. Complete frames are passed to Partitions.
+	Enforces some sanity checks. If the body does not fit and Admission
+	refuses a bigger buffer, reading pauses for read_retry_ms; TCP flow
+	control then holds the sender back.
+*/
+void Session::do_read( std::shared_ptr<Session> self )
+{
+	if ( m_stream )
+	{
+		do_read_stream( std::move( self ) );
+		return;
+	}
+	if ( packet_header_size > m_read_bytes )
+	{
+		do_read_header( std::move( self ) );
+		return;
+	}
+
+	//get data size
+	byte_int bi = {};
+	for ( int i = 0; i < 4; ++i ) bi.b[i] = m_buf[i];
+	const size_t data_size = bi.i;
+
+	if ( Session::max_packet_size - Session::packet_header_size < data_size )
+	{
+		std::cerr << "[ERROR] Announced packet body is too big (" << data_size << " bytes)\n";
+		close();
+		return;
+	}
+	if ( packet_header_size == m_read_bytes && cut_through_min <= data_size && open_stream( data_size ) )
+	{
+		do_read_stream( std::move( self ) );
+		return;
+	}
+	if ( packet_header_size + data_size > m_read_bytes )
+	{
+		if ( m_buf.size() < packet_header_size + data_size && !grow_buf( packet_header_size + data_size ) )
 		{
-			if ( packet_header_size > bytes_read )
-			{
-				std::cerr << "[WARNING] Malformed header recieved from " << m_client_address << "\n";
-				do_read_header();
-			}
-			else
-			{
-				//get data size
-				byte_int bi = {};
-				for ( int i = 0; i < 4; ++i ) bi.b[i] = m_buf[i];
-				const size_t data_size = bi.i;
+			m_admission.count_deferred_read();
+			m_timers.schedule( m_read_retry, std::chrono::milliseconds( read_retry_ms ) );
+			return;
+		}
+		do_read_body( std::move( self ), data_size );
+		return;
+	}
 
-				if ( 0 == data_size )
-				{
-					try
-					{
-						m_lobby.process_buf( self );
-					}
-					catch ( const std::out_of_range )
-					{
-						std::cerr << "[WARNING] Lobby::process_buf() -- ID map lookup failed\n";
-					}
-					do_read_header();
-				}
-				else if ( Session::max_packet_size - Session::packet_header_size < data_size )
-				{
-					std::cerr << "[ERROR] Announced packet body is too big (" << data_size << " bytes)\n";
-					m_lobby.disconnect( self );
-				}
-				else
-				{
-					do_read_body( data_size );
-				}
-			}
+	FlightRecorder::record( FlightRecorder::In, m_client_id, m_buf.data(), packet_header_size + data_size );
+	const unsigned int cmd = m_buf[4] | m_buf[5] << 8;
+	StatsSegment::count_in( cmd, packet_header_size + data_size );
+	m_read_bytes = 0;
+	{
+		const LoopMonitor::Handler handler( cmd );
+		m_partitions.process_buf( self );
+	}
+	if ( m_closed ) return;
+
+	//give memory of big packets back, responses may have grown the buffer too
+	if ( initial_buffer_size < m_buf.size() ) Buffer( initial_buffer_size ).swap( m_buf );
+	account_buf();
+	do_read_header( std::move( self ) );
+}
+
+
+/*
+	Charges the additional bytes before resizing, fails without any
+	change if the budget is exhausted.
+*/
+bool Session::grow_buf( size_t size )
+{
+	if ( !m_admission.try_charge( size - m_buf_accounted ) ) return false;
+	Trace<Session>::add_bytes( size - m_buf_accounted );
+	m_buf.resize( size );
+	m_buf_accounted = size;
+	return true;
+}
+
+
+/*
+	Settles size changes made outside of grow_buf() (Packet writes grow
+	the buffer on demand).
+*/
+void Session::account_buf()
+{
+	if ( m_buf.size() > m_buf_accounted )
+	{
+		m_admission.charge( m_buf.size() - m_buf_accounted );
+		Trace<Session>::add_bytes( m_buf.size() - m_buf_accounted );
+	}
+	else
+	{
+		m_admission.refund( m_buf_accounted - m_buf.size() );
+		Trace<Session>::sub_bytes( m_buf_accounted - m_buf.size() );
+	}
+	m_buf_accounted = m_buf.size();
+}
+
+
+/*
+	Reads the rest of packet_header_size bytes and proceeds with do_read().
+	Detects disconnection and reports to Lobby for notification purposes.
+	While suspended, only the progress is recorded.
+*/
+void Session::do_read_header( std::shared_ptr<Session> self )
+{
+	m_reading = true;
+	asio::async_read( m_socket, asio::buffer( &m_buf[m_read_bytes], packet_header_size - m_read_bytes ), make_handler( m_read_memory,
+	[this, self = std::move( self )]( asio::error_code ec, std::size_t bytes_read ) mutable
+	{
+		m_reading     = false;
+		m_read_bytes += bytes_read;
+		if ( 0 < bytes_read ) m_last_read = m_timers.now();
+		if ( m_suspended || m_closed ) return;//resume() continues
+
+		if ( !ec )
+		{
+			do_read( std::move( self ) );
 		}
 		else if ( asio::error::misc_errors::eof == ec )
 		{
-			m_lobby.disconnect( self );
+			close();
 		}
 		else
 		{
 			std::cerr << "[ERROR] Could not read packet header from " << m_client_address  << ": " << ec << "\n";
-			m_lobby.disconnect( self );
+			close( true );
 		}
-	} );
+	} ) );
 }
 
 
 /*
-	Reads passed amount of bytes. Enforces some sanity checks.
-	Detects disconnection and reports to Lobby for notification purposes.
+	Reads the rest of the packet body. Detects disconnection and reports
+	to Lobby for notification purposes. While suspended, only the
+	progress is recorded.
 */
-void Session::do_read_body( size_t data_size )
+void Session::do_read_body( std::shared_ptr<Session> self, size_t data_size )
 {
-	auto self( shared_from_this() );
-	asio::async_read( m_socket, asio::buffer( &m_buf[packet_header_size], data_size ),
-	[this, self, data_size]( asio::error_code ec, std::size_t bytes_read )
+	m_reading = true;
+	asio::async_read( m_socket, asio::buffer( &m_buf[m_read_bytes], packet_header_size + data_size - m_read_bytes ), make_handler( m_read_memory,
+	[this, self = std::move( self )]( asio::error_code ec, std::size_t bytes_read ) mutable
 	{
+		m_reading     = false;
+		m_read_bytes += bytes_read;
+		if ( 0 < bytes_read ) m_last_read = m_timers.now();
+		if ( m_suspended || m_closed ) return;//resume() continues
+
 		if ( !ec )
 		{
-			if ( data_size != bytes_read )
-			{
-				std::cerr << "[WARNING] Malformed packet recieved from " << m_client_address << "\n";
-			}
-			else
-			{
-				try
-				{
-					m_lobby.process_buf( self );
-				}
-				catch ( const std::out_of_range )
-				{
-					std::cerr << "[WARNING] Lobby::process_buf() -- ID map lookup failed\n";
-				}
-			}
-			do_read_header();
+			do_read( std::move( self ) );
 		}
 		else if ( asio::error::misc_errors::eof == ec )
 		{
-			m_lobby.disconnect( self );
+			close();
 		}
 		else
 		{
 			std::cerr << "[ERROR] Could not read packet body from " << m_client_address << ": " << ec << "\n";
-			m_lobby.disconnect( self );
+			close( true );
 		}
-	} );
+	} ) );
+}
+
+
+/*
+	Queues a stream buffer for the frame whose header is in m_buf, if
+	Lobby would forward the frame unchanged.
+*/
+bool Session::open_stream( size_t data_size )
+{
+	const auto stream = SendBuffer::create_stream( packet_header_size + data_size );
+	std::memcpy( stream.writable()->fill_pos(), m_buf.data(), packet_header_size );
+	stream.writable()->fill( packet_header_size );
+
+	std::vector<std::shared_ptr<Client>> targets;
+	if ( !m_partitions.open_stream( shared_from_this(), stream, targets ) ) return false;
+
+	m_stream = stream;
+	m_stream_targets.assign( targets.begin(), targets.end() );
+	return true;
+}
+
+
+/*
+	Reads whatever arrived of the stream body and passes it on. Unlike
+	other reads, a stream continues while suspended: the recipients have
+	part of the frame already, so it has to be completed before a hot
+	restart (suspended() waits for it).
+*/
+void Session::do_read_stream( std::shared_ptr<Session> self )
+{
+	const auto stream = m_stream;//keeps the memory alive for the read
+	m_reading = true;
+	m_socket.async_read_some( asio::buffer( stream.writable()->fill_pos(), stream->size() - stream->filled() ), make_handler( m_read_memory,
+	[this, self = std::move( self ), stream]( asio::error_code ec, std::size_t bytes_read ) mutable
+	{
+		m_reading = false;
+		if ( m_closed ) return;//close() padded the stream
+
+		if ( 0 < bytes_read )
+		{
+			m_last_read = m_timers.now();
+			stream.writable()->fill( bytes_read );
+			if ( stream->complete() ) close_stream( true );
+			else notify_stream_targets();
+		}
+
+		if ( asio::error::operation_aborted == ec && m_suspended )
+		{
+			//cancelled by suspend(), see above
+		}
+		else if ( asio::error::misc_errors::eof == ec )
+		{
+			close();
+			return;
+		}
+		else if ( ec )
+		{
+			std::cerr << "[ERROR] Could not read packet body from " << m_client_address << ": " << ec << "\n";
+			close( true );
+			return;
+		}
+
+		if      ( m_stream )     do_read_stream( std::move( self ) );
+		else if ( !m_suspended ) do_read_header( std::move( self ) );
+	} ) );
+}
+
+
+void Session::notify_stream_targets()
+{
+	for ( const auto& target : m_stream_targets )
+	{
+		const auto client = target.lock();
+		if ( client ) client->stream_progress();
+	}
+}
+
+
+void Session::close_stream( bool complete )
+{
+	auto& stream = *m_stream.writable();
+	if ( complete )
+	{
+		FlightRecorder::record( FlightRecorder::In, m_client_id, stream.data(), stream.size() );
+		StatsSegment::count_in( stream.data()[4] | stream.data()[5] << 8, stream.size() );
+	}
+	else
+	{
+		std::cerr << "[WARNING] Forwarded frame from " << m_client_address << " broke off after "
+		          << stream.filled() << " of " << stream.size() << " bytes, padding with zeros\n";
+		std::memset( stream.fill_pos(), 0, stream.size() - stream.filled() );
+		stream.fill( stream.size() - stream.filled() );
+	}
+	notify_stream_targets();
+	m_stream = BufPtr();
+	m_stream_targets.clear();
+	m_read_bytes = 0;
+}
+
+
+/*
+	Stops reading and writing. Pending operations are cancelled, their
+	handlers record how far they got. Has to be repeated until suspended()
+	returns true, since composed operations can have a step in flight.
+*/
+void Session::suspend()
+{
+	m_suspended = true;
+	asio::error_code ec;
+	m_socket.cancel( ec );
+}
+
+
+/*
+	Continues reading and writing where suspend() stopped, or where the
+	previous server process stopped (see restore()).
+*/
+void Session::resume()
+{
+	m_suspended = false;
+	if ( !m_deadline_check.scheduled() ) schedule_deadline_check();
+	if ( !queue_empty() && !m_writing ) do_send_buf( shared_from_this() );
+	await_zerocopy();
+	if ( !m_reading && !m_read_retry.scheduled() ) do_read( shared_from_this() );
+}
+
+
+/*
+	Sends a Handoff::SessionState record with the socket attached:
+	id1 = Client ID
+	data:
+		2 len
+		^ string = partition key (empty: reception)
+		4 int = bytes of the current frame read so far
+		^ bytes
+		4 int = bytes of the first send buffer already written
+		4 int = number of send buffers
+			4 int = len
+			^ bytes
+		4 int = ID of the next zero copy send call
+		4 int = number of send buffers at the end which take the lobby lane
+	The partly sent buffer comes first, followed by the game lane.
+*/
+void Session::hand_off( Handoff& handoff, const std::string& partition )
+{
+	const Queued* partial = 0 < m_send_offset ? &m_lanes[m_send_lane].front() : nullptr;
+	std::vector<const BufPtr*> queue;
+	if ( partial ) queue.push_back( &partial->buf );
+	for ( const auto& lane : m_lanes )
+	{
+		for ( const auto& q : lane ) if ( &q != partial ) queue.push_back( &q.buf );
+	}
+	const auto lobby_lane = m_lanes[LobbyLane].size() - ( partial && LobbyLane == m_send_lane ? 1 : 0 );
+
+	size_t size = packet_header_size + 2 + partition.size() + 4 + m_read_bytes + 16;
+	for ( const auto b : queue ) size += 4 + ( *b )->size();
+
+	Buffer buf( size );
+	Packet p( buf, m_client_id );
+	p.seek_to_start();
+	p.write_string( partition, Packet::Short );
+	p.write_int( static_cast<unsigned int>( m_read_bytes ) );
+	std::memcpy( &buf[p.seek_pos()], m_buf.data(), m_read_bytes );
+	p.seek( static_cast<unsigned int>( m_read_bytes ) );
+	p.write_int( static_cast<unsigned int>( m_send_offset ) );
+	p.write_int( static_cast<unsigned int>( queue.size() ) );
+	for ( const auto queued : queue )
+	{
+		const auto& b = *queued;
+		p.write_int( static_cast<unsigned int>( b->size() ) );
+		std::memcpy( &buf[p.seek_pos()], b->data(), b->size() );
+		p.seek( static_cast<unsigned int>( b->size() ) );
+	}
+	p.write_int( m_zerocopy.next_id() );
+	p.write_int( static_cast<unsigned int>( lobby_lane ) );
+	p.write_header( Handoff::SessionState, m_client_id, 0 );
+	handoff.send( buf, p.send_size(), static_cast<int>( m_socket.native_handle() ) );
+}
+
+
+/*
+	Takes over the state sent by hand_off() in the previous process.
+	The Session stays suspended until resume().
+*/
+std::string Session::restore( Packet& p )
+{
+	const auto& buf = p.buf();
+	m_client_id = p.id1();
+	m_suspended = true;
+
+	const auto partition = p.read_string( Packet::Short );
+	m_read_bytes = std::min<size_t>( p.read_int(), max_packet_size );
+	if ( m_buf.size() < m_read_bytes ) m_buf.resize( m_read_bytes );
+	account_buf();
+	std::memcpy( m_buf.data(), &buf[p.seek_pos()], m_read_bytes );
+	p.seek( static_cast<unsigned int>( m_read_bytes ) );
+
+	m_send_offset = p.read_int();
+	const auto count = p.read_int();
+	std::vector<BufPtr> queue;
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		const auto size = p.read_int();
+		const auto at   = std::min<size_t>( p.seek_pos(), buf.size() );
+		queue.push_back( SendBuffer::create( buf.data() + at, std::min<size_t>( size, buf.size() - at ) ) );
+		p.seek( size );
+	}
+	m_zerocopy.set_next_id( p.read_int() );
+	const auto game_lane = queue.size() - std::min<size_t>( p.read_int(), queue.size() );
+	for ( size_t i = 0; i < queue.size(); ++i ) enqueue( queue[i], game_lane > i ? GameLane : LobbyLane );
+	m_send_lane = GameLane;
+	return partition;
 }
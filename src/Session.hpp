@@ -7,24 +7,75 @@
 #pragma once
 #include "Precompiled.hpp"
 
+#include "Admission.hpp"
 #include "Client.hpp"
-#include "Lobby.hpp"
+#include "HandlerMemory.hpp"
+#include "Options.hpp"
+#include "Partitions.hpp"
+#include "TcpMonitor.hpp"
+#include "TimerWheel.hpp"
+#include "Trace.hpp"
+#include "ZeroCopy.hpp"
 
 using namespace asio::ip;
 
+//accounting tag for bytes waiting in Session send queues (see Trace.cpp)
+struct QueuedSend;
+
 /*
 	Session class provides asynchronous reading and writing to/from a
-	local buffer large enough for the biggest packets (map data on game
-	start). It stores Client ID (assigned by Lobby on connection), and
+	local buffer. The buffer starts with initial_buffer_size bytes and
+	grows up to max_packet_size for the biggest packets (map data on game
+	start), as far as Admission allows. It stores Client ID (assigned by Lobby on connection), and
 	a local queue of shared pointers to send buffers. The pointers are
 	shared with other targetet Clients and ensure that the buffer stays
 	alive until every Session finishes the async_write() and pop's the
 	pointer from it's local queue.
+
+	Connections which miss a deadline (login, idle or send progress, see
+	check_deadlines()) are closed like any other broken connection.
+
+	While the player is in a running game, a vanished peer has to be
+	noticed quickly: the game of everyone else freezes until the host
+	transition (see Lobby::disconnect()) runs. Such connections get TCP
+	keepalive probes every second and a TCP user timeout of game_timeout,
+	and a send queue stalled for game_timeout closes them too. The time
+	from the last received data to the detection is recorded, see
+	print_failure_detection().
+
+	Big 0x4b0 frames (map data on game start) are forwarded while they
+	arrive: once the header is known, a stream buffer for the whole frame
+	is queued for the recipients (see Lobby::open_stream()) and the body
+	is read right into it. Recipients send what has arrived so far and
+	continue on stream_progress(). The stream buffer keeps its place in
+	their queues, so the order against other packets is the same as with
+	store and forward.
+
+	The send queue has two lanes (see Client::Lane). While the player is
+	in a game, the game lane is always sent first, so relayed game data
+	does not wait behind lobby notifications the game does not show.
+	Outside a game everything goes through the lobby lane, which keeps
+	lobby notifications and replies in order. A buffer is always written
+	completely before the next lane is chosen.
+
+	The lanes only order what is handed to the kernel. With Nagle's
+	algorithm the kernel would then hold every small game buffer until
+	the previous one is acknowledged (up to 40 ms of delayed ACK on
+	Linux), longer than any wait in the queue. The lane priority and the
+	queue delay shown by print_queue_delay() would not reflect when game
+	data leaves the server. So Sessions set TCP_NODELAY.
+
+	The read loop and the write loop each pass one owning reference to
+	the Session on from handler to handler, moving instead of copying it,
+	and their operations use the recycled memory of m_read_memory and
+	m_write_memory. A loop which stops (on error, suspend() or an empty
+	queue) drops its reference.
 */
 class Session : public Client, public std::enable_shared_from_this<Session>
 {
 public:
-	Session( tcp::socket socket, Lobby& lobby );
+	Session( tcp::socket socket, Partitions& partitions, TimerWheel& timers, Admission& admission, TcpMonitor& tcp_monitor, const Options& options );
+	~Session();
 
 	void start();
 
@@ -34,23 +85,115 @@ public:
 	const std::string& address() const { return m_client_address; };
 	Buffer&            buf()           { return m_buf;            };
 
-	void queue_buf( const BufPtr& buf );
+	size_t  queue_depth() const { return m_lanes[GameLane].size() + m_lanes[LobbyLane].size(); };
+	size_t queued_bytes() const { return m_queued_bytes; };
+	const TcpMonitor::Stats& tcp_stats() const { return m_tcp_probe.stats(); };
+
+	void queue_buf( const BufPtr& buf, Lane lane );
+	void stream_progress();
+
+	void set_in_game( bool in_game );
+	void kick();
 
-	enum { max_packet_size    = 0x100000 };//1 MiB
-	enum { packet_header_size = 14       };
+	//hot restart, see Handoff class
+	void suspend();
+	bool suspended() const { return m_suspended && !m_reading && !m_writing && !m_zc_waiting; };
+	void resume();
+	void hand_off( Handoff& handoff, const std::string& partition );
+	//reads a Handoff::SessionState record, returns the partition key
+	std::string restore( Packet& p );
+
+	//detection latency of failed in-game connections
+	static void print_failure_detection( std::ostream& out );
+	//time from queueing to the start of sending, per lane
+	static void print_queue_delay( std::ostream& out );
+
+	enum { max_packet_size     = 0x100000 };//1 MiB
+	enum { initial_buffer_size = 0x4000   };//16 KiB, charged by Server on accept
+	enum { packet_header_size  = 14       };
+	enum { keepalive_interval  = 1        };//seconds, while in game
+	enum { cut_through_min     = 0x10000  };//64 KiB, smaller 0x4b0 frames are stored and forwarded
+	enum { read_retry_ms       = 100      };//while Admission refuses a bigger buffer
 	
 private:
-	void do_read_header();
-	void do_read_body( size_t data_size );
-	void do_send_buf();
+	//disconnects through Partitions once, closes the socket; failed
+	//connections of players in a game record the detection latency
+	void close( bool failed = false );
+
+	//keepalive and TCP user timeout according to m_in_game
+	void apply_liveness_options();
+
+	//login, idle and send progress deadlines, see Options
+	void check_deadlines();
+	void schedule_deadline_check();
+
+	void do_read( std::shared_ptr<Session> self );
+	//resizes m_buf and settles the difference with Admission
+	bool grow_buf( size_t size );
+	void account_buf();
+	void do_read_header( std::shared_ptr<Session> self );
+	void do_read_body( std::shared_ptr<Session> self, size_t data_size );
+	void enqueue( const BufPtr& buf, Lane lane );
+	bool queue_empty() const { return m_lanes[GameLane].empty() && m_lanes[LobbyLane].empty(); };
+	void do_send_buf( std::shared_ptr<Session> self );
+	void await_zerocopy();
+
+	//cut-through forwarding of the current frame, see above
+	bool open_stream( size_t data_size );
+	void do_read_stream( std::shared_ptr<Session> self );
+	void notify_stream_targets();
+	//an incomplete stream is padded with zeros to keep the recipients' framing
+	void close_stream( bool complete );
 
 	unsigned int m_client_id;
 	std::string  m_client_address;
 	tcp::socket  m_socket;
-	Lobby&       m_lobby;
+	TcpMonitor::Probe m_tcp_probe;
+	Partitions&  m_partitions;
 	Buffer       m_buf;
+	size_t       m_buf_accounted;//m_buf size known to Admission and Trace
+	bool         m_closed;
+	Admission&   m_admission;
+	TimerWheel::Entry m_read_retry;
+
+	TimerWheel&        m_timers;
+	const Options&     m_options;
+	TimerWheel::Entry  m_deadline_check;
+	std::chrono::steady_clock::time_point m_connected;
+	std::chrono::steady_clock::time_point m_last_read;//last received bytes
+	std::chrono::steady_clock::time_point m_last_sent;//last completed write, or start of sending
+
+	struct Queued
+	{
+		BufPtr buf;
+		std::chrono::steady_clock::time_point since;//cleared when sending starts
+	};
+	std::deque<Queued> m_lanes[lane_count];
+	Lane               m_send_lane;//lane of the buffer being sent
+	size_t             m_queued_bytes;
+
+	//progress of the current frame and of the front send buffer, kept
+	//across suspend() and resume() (also in another process)
+	size_t m_read_bytes;
+	size_t m_send_offset;
+	bool   m_reading;
+	bool   m_writing;
+	bool   m_suspended;
+
+	bool   m_in_game;
+
+	//frame being forwarded while it is received
+	BufPtr                            m_stream;
+	std::vector<std::weak_ptr<Client>> m_stream_targets;
+
+	ZeroCopy m_zerocopy;
+	bool     m_zc_waiting;
+
+	HandlerMemory m_read_memory;
+	HandlerMemory m_write_memory;
+	HandlerMemory m_wait_memory;//zero copy notifications
 
-	std::deque<BufPtr> m_buf_queue;
+	Trace<Session> m_trace;
 
 	//necessary to read 1st int in header (data size)
 	union byte_int
@@ -0,0 +1,90 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+/*
+	Layout of the shared memory statistics segment (see StatsSegment),
+	also used by tools/cossacks3-stats.cpp. Plain data only, so readers
+	need nothing but this header.
+
+	The header is written once. The server rewrites the data block every
+	publish interval under a sequence lock: seq is odd while the data is
+	being written. A reader copies the data block and keeps the copy if
+	seq was even and unchanged before and after copying:
+
+		do
+		{
+			s1 = header.seq.load( std::memory_order_acquire );
+			copy = data;
+			std::atomic_thread_fence( std::memory_order_acquire );
+		}
+		while ( ( s1 & 1 ) || s1 != header.seq.load( std::memory_order_relaxed ) );
+
+	Change version with every layout change.
+*/
+struct SharedStats
+{
+	enum { magic        = 0x33435353 };//"SSC3"
+	enum { version      = 1 };
+	enum { lag_buckets  = 12 };//see LoopMonitor
+	enum { max_commands = 128 };
+
+	struct Header
+	{
+		uint32_t              magic;
+		uint32_t              version;
+		uint32_t              size;//of the whole segment
+		uint32_t              pid;
+		std::atomic<uint64_t> seq;
+	};
+
+	//packets and bytes per command code; out counts send buffers, which
+	//can hold several packets (batched notifications, see Lobby)
+	struct Command
+	{
+		uint32_t cmd;
+		uint32_t reserved;
+		uint64_t in_packets;
+		uint64_t in_bytes;
+		uint64_t out_packets;
+		uint64_t out_bytes;
+	};
+
+	struct Data
+	{
+		uint64_t published_ms;//Unix time
+		uint64_t started_ms;
+
+		uint64_t partitions;
+		uint64_t clients;
+		uint64_t players;//including players of linked servers
+		uint64_t rooms;
+
+		//Session send queues
+		uint64_t queued_packets;
+		uint64_t queued_bytes;
+		uint64_t max_queued_bytes;//of one Session
+
+		//event loop, see LoopMonitor
+		int64_t  loop_busy_permille;//last window, -1: not known yet
+		uint64_t loop_probes;
+		uint64_t loop_lag_max_us;
+		uint64_t loop_lag[lag_buckets];//<1 ms, <2 ms, ... <1024 ms, longer
+		uint64_t loop_stalls;
+
+		uint32_t commands;//used entries of command, ascending by cmd
+		uint32_t reserved;
+		Command  command[max_commands];
+	};
+
+	Header header;
+	Data   data;
+};
+
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2, "the sequence counter must be lock-free to work across processes" );
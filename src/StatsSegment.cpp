@@ -0,0 +1,144 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "LoopMonitor.hpp"
+#include "StatsSegment.hpp"
+
+static_assert( static_cast<int>( SharedStats::lag_buckets ) == LoopMonitor::lag_buckets, "lag histogram layout" );
+
+StatsSegment::Counters StatsSegment::s_counters[command_slots] = {};
+
+static uint64_t unix_ms()
+{
+	using namespace std::chrono;
+	return duration_cast<milliseconds>( system_clock::now().time_since_epoch() ).count();
+}
+
+
+/*
+	An old segment of the same name (left by a crashed server, or by the
+	server this one takes over from) is replaced, its readers keep the
+	old contents until they map it again.
+*/
+StatsSegment::StatsSegment( TimerWheel& timers, const Partitions& partitions, const std::string& name ) :
+	m_timers    ( timers ),
+	m_partitions( partitions ),
+	m_publish   ( [this]() { publish(); } ),
+	m_name      ( name ),
+	m_segment   ( nullptr ),
+	m_started_ms( unix_ms() )
+{
+	if ( m_name.empty() ) return;
+#ifdef __linux__
+	if ( '/' != m_name[0] ) m_name.insert( 0, "/" );
+	::shm_unlink( m_name.c_str() );
+	const int fd = ::shm_open( m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644 );
+	void* p = MAP_FAILED;
+	if ( 0 <= fd )
+	{
+		if ( 0 == ::ftruncate( fd, sizeof( SharedStats ) ) )
+		{
+			p = ::mmap( nullptr, sizeof( SharedStats ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+		}
+		::close( fd );
+	}
+	if ( MAP_FAILED == p )
+	{
+		std::cerr << "[WARNING] Could not create statistics segment " << m_name << ": " << std::strerror( errno ) << "\n";
+		::shm_unlink( m_name.c_str() );
+		return;
+	}
+
+	//the segment is zero filled; the sequence counter starts even
+	m_segment = static_cast<SharedStats*>( p );
+	new ( &m_segment->header.seq ) std::atomic<uint64_t>( 0 );
+	m_segment->header.size    = sizeof( SharedStats );
+	m_segment->header.pid     = static_cast<uint32_t>( ::getpid() );
+	m_segment->header.version = SharedStats::version;
+	std::atomic_thread_fence( std::memory_order_release );
+	m_segment->header.magic   = SharedStats::magic;
+
+	publish();
+#else
+	std::cerr << "[WARNING] --stats-shm is not supported on this platform\n";
+#endif
+}
+
+
+StatsSegment::~StatsSegment()
+{
+#ifdef __linux__
+	if ( !m_segment ) return;
+	::munmap( m_segment, sizeof( SharedStats ) );
+	//a successor may have replaced the segment already
+	const int fd = ::shm_open( m_name.c_str(), O_RDONLY, 0 );
+	if ( 0 > fd ) return;
+	uint32_t pid = 0;
+	if ( sizeof( pid ) == ::pread( fd, &pid, sizeof( pid ), offsetof( SharedStats::Header, pid ) ) && ::getpid() == static_cast<pid_t>( pid ) )
+	{
+		::shm_unlink( m_name.c_str() );
+	}
+	::close( fd );
+#endif
+}
+
+
+/*
+	The snapshot is gathered first, so the sequence lock is only held
+	for one copy.
+*/
+void StatsSegment::publish()
+{
+	SharedStats::Data data = {};
+	data.published_ms = unix_ms();
+	data.started_ms   = m_started_ms;
+
+	Lobby::Census census;
+	m_partitions.census( census );
+	data.partitions       = m_partitions.partition_count();
+	data.clients          = census.clients;
+	data.players          = census.players;
+	data.rooms            = census.rooms;
+	data.queued_packets   = census.queued_packets;
+	data.queued_bytes     = census.queued_bytes;
+	data.max_queued_bytes = census.max_queued_bytes;
+
+	const auto loop = LoopMonitor::figures();
+	data.loop_busy_permille = loop.busy_permille;
+	data.loop_probes        = loop.probes;
+	data.loop_lag_max_us    = loop.lag_max_us;
+	std::copy( loop.lag, loop.lag + LoopMonitor::lag_buckets, data.loop_lag );
+	data.loop_stalls        = loop.stalls;
+
+	for ( unsigned int cmd = 0; command_slots > cmd && SharedStats::max_commands > data.commands; ++cmd )
+	{
+		const auto& c = s_counters[cmd];
+		if ( !c.in_packets && !c.out_packets ) continue;
+		auto& entry = data.command[data.commands++];
+		entry.cmd         = cmd;
+		entry.in_packets  = c.in_packets;
+		entry.in_bytes    = c.in_bytes;
+		entry.out_packets = c.out_packets;
+		entry.out_bytes   = c.out_bytes;
+	}
+
+	auto& seq = m_segment->header.seq;
+	const auto s = seq.load( std::memory_order_relaxed );
+	seq.store( s + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+	std::memcpy( &m_segment->data, &data, sizeof( data ) );
+	seq.store( s + 2, std::memory_order_release );
+
+	m_timers.schedule( m_publish, std::chrono::milliseconds( publish_ms ) );
+}
@@ -0,0 +1,60 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "Partitions.hpp"
+#include "SharedStats.hpp"
+#include "TimerWheel.hpp"
+
+/*
+	Publishes live counters into the POSIX shared memory segment given by
+	--stats-shm (appears as /dev/shm/NAME on Linux), see SharedStats for
+	the layout. External tools read it as often as they like without any
+	system call into the server or work for its event loop; the server
+	only copies one snapshot into the segment every publish_ms.
+
+	The packet counters per command code are kept all the time (see
+	count_in() and count_out(), called by Session), the rest is gathered
+	when publishing.
+
+	Linux only, elsewhere --stats-shm is ignored with a warning.
+*/
+class StatsSegment
+{
+public:
+	enum { publish_ms    = 100 };
+	enum { command_slots = 0x1000 };//command codes are counted modulo this
+
+	//name empty: no segment
+	StatsSegment( TimerWheel& timers, const Partitions& partitions, const std::string& name );
+	~StatsSegment();
+	StatsSegment( const StatsSegment& ) = delete;
+	StatsSegment& operator =( const StatsSegment& ) = delete;
+
+	static void count_in ( unsigned int cmd, size_t bytes ) { auto& c = s_counters[cmd % command_slots]; ++c.in_packets;  c.in_bytes  += bytes; };
+	static void count_out( unsigned int cmd, size_t bytes ) { auto& c = s_counters[cmd % command_slots]; ++c.out_packets; c.out_bytes += bytes; };
+
+private:
+	void publish();
+
+	struct Counters
+	{
+		unsigned long long in_packets;
+		unsigned long long in_bytes;
+		unsigned long long out_packets;
+		unsigned long long out_bytes;
+	};
+	static Counters s_counters[command_slots];
+
+	TimerWheel&       m_timers;
+	const Partitions& m_partitions;
+	TimerWheel::Entry m_publish;
+	std::string       m_name;
+	SharedStats*      m_segment;
+	uint64_t          m_started_ms;
+};
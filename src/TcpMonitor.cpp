@@ -0,0 +1,143 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "TcpMonitor.hpp"
+
+
+TcpMonitor::TcpMonitor( asio::io_service& io_service, TimerWheel& timers, unsigned int interval_s ) :
+	m_io_service( io_service ),
+	m_timers    ( timers ),
+	m_interval  ( std::chrono::seconds( interval_s ) ),
+	m_tick      ( [this]() { start_pass(); } ),
+	m_cursor    ( nullptr ),
+	m_passing   ( false )
+{}
+
+
+void TcpMonitor::add( Probe* probe )
+{
+	m_probes.insert( probe );
+	if ( 0 != m_interval.count() && !m_passing && !m_tick.scheduled() ) m_timers.schedule( m_tick, m_interval );
+}
+
+
+void TcpMonitor::remove( Probe* probe )
+{
+	m_probes.erase( probe );
+}
+
+
+void TcpMonitor::start_pass()
+{
+	m_passing = true;
+	m_cursor  = nullptr;
+	continue_pass();
+}
+
+
+/*
+	Samples the next batch_size Probes after m_cursor. The next pass is
+	scheduled an interval after this one ends, so a slow pass can not
+	pile up.
+*/
+void TcpMonitor::continue_pass()
+{
+	auto it = m_cursor ? m_probes.upper_bound( m_cursor ) : m_probes.begin();
+	for ( unsigned int n = 0; batch_size > n && m_probes.end() != it; ++n, ++it )
+	{
+		( *it )->sample();
+		m_cursor = *it;
+	}
+
+	if ( m_probes.end() != it )
+	{
+		m_io_service.post( [this]() { continue_pass(); } );
+		return;
+	}
+	m_passing = false;
+	if ( !m_probes.empty() ) m_timers.schedule( m_tick, m_interval );
+}
+
+
+void TcpMonitor::print_header( std::ostream& out )
+{
+	out << std::right << std::setw( 9 ) << "rtt us" << std::setw( 9 ) << "rttvar" << std::setw( 9 ) << "max"
+	    << std::setw( 6 ) << "retr" << std::setw( 6 ) << "cwnd" << std::setw( 9 ) << "unsent";
+}
+
+
+void TcpMonitor::print( std::ostream& out, const Stats& stats )
+{
+	out << std::right;
+	if ( !stats.samples )
+	{
+		out << std::setw( 9 ) << "-" << std::setw( 9 ) << "-" << std::setw( 9 ) << "-"
+		    << std::setw( 6 ) << "-" << std::setw( 6 ) << "-" << std::setw( 9 ) << "-";
+		return;
+	}
+	out << std::setw( 9 ) << stats.rtt_us << std::setw( 9 ) << stats.rttvar_us << std::setw( 9 ) << stats.rtt_max_us
+	    << std::setw( 6 ) << stats.retransmits << std::setw( 6 ) << stats.cwnd << std::setw( 9 ) << stats.unsent_bytes;
+}
+
+
+TcpMonitor::Probe::Probe( TcpMonitor& monitor, asio::ip::tcp::socket& socket ) :
+	m_monitor( monitor ),
+	m_socket ( socket ),
+	m_past   (),
+	m_next   ( 0 )
+{
+	m_monitor.add( this );
+}
+
+
+TcpMonitor::Probe::~Probe()
+{
+	m_monitor.remove( this );
+}
+
+
+/*
+	One getsockopt() for TCP_INFO, one ioctl() for the bytes not sent
+	yet (the TCP_INFO field for it is missing in older C libraries).
+*/
+void TcpMonitor::Probe::sample()
+{
+#if defined( __linux__ ) && defined( TCP_INFO ) && defined( SIOCOUTQNSD )
+	if ( !m_socket.is_open() ) return;
+	const int fd = m_socket.native_handle();
+
+	struct tcp_info info;
+	socklen_t size = sizeof( info );
+	if ( 0 != ::getsockopt( fd, IPPROTO_TCP, TCP_INFO, &info, &size ) ) return;
+	int unsent = 0;
+	if ( 0 != ::ioctl( fd, SIOCOUTQNSD, &unsent ) ) unsent = 0;
+
+	m_past[m_next] = { info.tcpi_rtt, info.tcpi_total_retrans };
+	m_next = ( m_next + 1 ) % window;
+	++m_stats.samples;
+
+	//once the ring is full, m_next is the oldest sample
+	const unsigned int filled = static_cast<unsigned int>( std::min<unsigned long long>( m_stats.samples, window ) );
+	const auto& oldest = m_past[window > m_stats.samples ? 0 : m_next];
+	unsigned int rtt_max = 0;
+	for ( unsigned int i = 0; filled > i; ++i ) rtt_max = std::max( rtt_max, m_past[i].rtt_us );
+
+	m_stats.rtt_us       = info.tcpi_rtt;
+	m_stats.rttvar_us    = info.tcpi_rttvar;
+	m_stats.rtt_max_us   = rtt_max;
+	m_stats.retransmits  = info.tcpi_total_retrans - oldest.total_retransmits;
+	m_stats.cwnd         = info.tcpi_snd_cwnd;
+	m_stats.unsent_bytes = static_cast<unsigned int>( std::max( unsent, 0 ) );
+#endif
+}
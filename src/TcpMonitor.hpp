@@ -0,0 +1,96 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "TimerWheel.hpp"
+
+/*
+	Samples the kernel's view of every client connection (TCP_INFO) at a
+	fixed interval, so a bad link of one player (high or jumping round
+	trip, retransmits, a collapsed congestion window, data piling up in
+	the kernel send buffer) can be told apart from a slow server.
+
+	Every Session owns a Probe. A single TimerWheel entry starts a pass
+	over all Probes; a pass samples at most batch_size of them per event
+	loop turn and posts the rest, so relaying never waits for more than a
+	few dozen getsockopt() calls. Each Probe keeps the last sample and
+	the maximum round trip and the retransmits of the last window
+	samples. Lobby::print_clients() shows them next to the Client ID and
+	player name.
+
+	Linux only, elsewhere the Probes stay empty.
+*/
+class TcpMonitor
+{
+public:
+	enum { batch_size = 64 };
+	enum { window     = 16 };//samples
+
+	struct Stats
+	{
+		unsigned long long samples      = 0;
+		unsigned int       rtt_us       = 0;//smoothed by the kernel
+		unsigned int       rttvar_us    = 0;
+		unsigned int       rtt_max_us   = 0;//highest rtt_us of the window
+		unsigned int       retransmits  = 0;//during the window
+		unsigned int       cwnd         = 0;//segments
+		unsigned int       unsent_bytes = 0;//in the kernel send buffer
+	};
+
+	class Probe
+	{
+	public:
+		Probe( TcpMonitor& monitor, asio::ip::tcp::socket& socket );
+		~Probe();
+		Probe( const Probe& ) = delete;
+		Probe& operator =( const Probe& ) = delete;
+
+		const Stats& stats() const { return m_stats; };
+
+	private:
+		friend class TcpMonitor;
+		void sample();
+
+		TcpMonitor&            m_monitor;
+		asio::ip::tcp::socket& m_socket;
+		Stats                  m_stats;
+
+		//rtt_us and total retransmits of the last window samples
+		struct Past
+		{
+			unsigned int rtt_us;
+			unsigned int total_retransmits;
+		};
+		Past         m_past[window];
+		unsigned int m_next;
+	};
+
+	//interval_s 0: no sampling
+	TcpMonitor( asio::io_service& io_service, TimerWheel& timers, unsigned int interval_s );
+
+	//header and columns for Stats, see Lobby::print_clients()
+	static void print_header( std::ostream& out );
+	static void print       ( std::ostream& out, const Stats& stats );
+
+private:
+	void add   ( Probe* probe );
+	void remove( Probe* probe );
+	void start_pass();
+	void continue_pass();
+
+	asio::io_service&               m_io_service;
+	TimerWheel&                     m_timers;
+	const std::chrono::milliseconds m_interval;
+	TimerWheel::Entry               m_tick;
+
+	//ordered by address, so a pass can continue after the Probe it
+	//stopped at even if that one is gone by then
+	std::set<Probe*> m_probes;
+	Probe*           m_cursor;
+	bool             m_passing;
+};
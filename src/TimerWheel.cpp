@@ -0,0 +1,178 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "TimerWheel.hpp"
+
+void TimerWheel::Entry::cancel()
+{
+	if ( !prev ) return;
+	prev->next = next;
+	next->prev = prev;
+	prev = next = nullptr;
+	--m_wheel->m_size;
+}
+
+
+TimerWheel::TimerWheel( asio::io_service& io_service ) :
+	m_timer( io_service ),
+	m_armed( false ),
+	m_size ( 0 ),
+	m_tick ( 0 ),
+	m_now  ( std::chrono::steady_clock::now() )
+{
+	for ( auto& level : m_slots )
+	{
+		for ( auto& head : level ) head.prev = head.next = &head;
+	}
+}
+
+
+/*
+	Unlinks all entries, their owners may outlive the wheel.
+*/
+TimerWheel::~TimerWheel()
+{
+	for ( auto& level : m_slots )
+	{
+		for ( auto& head : level )
+		{
+			while ( head.next != &head ) static_cast<Entry*>( head.next )->cancel();
+		}
+	}
+}
+
+
+void TimerWheel::schedule( Entry& entry, std::chrono::milliseconds delay )
+{
+	entry.cancel();
+	if ( !m_armed ) m_now = std::chrono::steady_clock::now();
+
+	//m_tick is processed one tick_ms after m_now
+	const long long ticks = ( delay.count() + tick_ms - 1 ) / tick_ms;
+	entry.m_expiry = m_tick + ( 1 < ticks ? ticks - 1 : 0 );
+	entry.m_wheel  = this;
+	place( entry );
+	++m_size;
+
+	if ( !m_armed ) arm();
+}
+
+
+void TimerWheel::arm()
+{
+	m_armed = true;
+	m_timer.expires_at( m_now + std::chrono::milliseconds( tick_ms ) );
+	m_timer.async_wait(
+	[this]( asio::error_code ec )
+	{
+		if ( !ec ) do_tick();
+	} );
+}
+
+
+/*
+	Links the entry into the slot of the lowest level which covers its
+	distance to the current tick. The slot index is taken from the expiry
+	tick itself, see cascade().
+*/
+void TimerWheel::place( Entry& entry )
+{
+	const unsigned long long max_delta = ( 1ull << ( slot_bits * levels ) ) - 1;
+	if ( entry.m_expiry < m_tick ) entry.m_expiry = m_tick;
+	if ( entry.m_expiry - m_tick > max_delta ) entry.m_expiry = m_tick + max_delta;
+
+	const auto delta = entry.m_expiry - m_tick;
+	unsigned int level = 0;
+	while ( level + 1 < levels && ( 1ull << ( slot_bits * ( level + 1 ) ) ) <= delta ) ++level;
+
+	Link& head = m_slots[level][( entry.m_expiry >> ( slot_bits * level ) ) & ( slots_per_level - 1 )];
+	entry.prev = head.prev;
+	entry.next = &head;
+	head.prev->next = &entry;
+	head.prev = &entry;
+}
+
+
+/*
+	Moves the entries of the current slot of the level down, returns the
+	slot index. Called when the level below wraps around.
+*/
+unsigned int TimerWheel::cascade( unsigned int level )
+{
+	const auto index = static_cast<unsigned int>( ( m_tick >> ( slot_bits * level ) ) & ( slots_per_level - 1 ) );
+	Link& head = m_slots[level][index];
+	Link work;
+	if ( head.next == &head ) return index;
+
+	//move the list to a local head, then re-place every entry
+	work.next = head.next;
+	work.prev = head.prev;
+	work.next->prev = work.prev->next = &work;
+	head.prev = head.next = &head;
+	while ( work.next != &work )
+	{
+		auto& entry = *static_cast<Entry*>( work.next );
+		work.next = entry.next;
+		work.next->prev = &work;
+		place( entry );
+	}
+	return index;
+}
+
+
+/*
+	Processes one tick: cascades higher levels if level 0 wrapped around,
+	then expires the entries of the current level 0 slot.
+*/
+void TimerWheel::advance()
+{
+	const auto index = m_tick & ( slots_per_level - 1 );
+	if ( 0 == index )
+	{
+		for ( unsigned int level = 1; level < levels; ++level )
+		{
+			if ( 0 != cascade( level ) ) break;
+		}
+	}
+
+	Link& head = m_slots[0][index];
+	++m_tick;
+	if ( head.next == &head ) return;
+
+	Link work;
+	work.next = head.next;
+	work.prev = head.prev;
+	work.next->prev = work.prev->next = &work;
+	head.prev = head.next = &head;
+	while ( work.next != &work )
+	{
+		auto& entry = *static_cast<Entry*>( work.next );
+		entry.cancel();
+		entry.m_on_expire();
+	}
+}
+
+
+/*
+	Timer handler. Catches up on ticks missed while the event loop was
+	busy, keeps ticking while entries are scheduled.
+*/
+void TimerWheel::do_tick()
+{
+	const auto now  = std::chrono::steady_clock::now();
+	const auto tick = std::chrono::milliseconds( tick_ms );
+	while ( m_now + tick <= now )
+	{
+		m_now += tick;
+		advance();
+	}
+
+	//entries scheduled meanwhile did not arm, the wheel was still armed
+	m_armed = false;
+	if ( 0 != m_size ) arm();
+}
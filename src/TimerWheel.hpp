@@ -0,0 +1,87 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+/*
+	Hierarchical timing wheel for large numbers of coarse deadlines (one
+	per Session). A single Asio timer ticks every tick_ms while entries
+	are scheduled. Each of the levels has slots_per_level slots, every
+	level covering slots_per_level times the range of the level below:
+	  level 0: 100 ms slots, 6.4 s range
+	  level 1:   6.4 s slots, 6.8 min range
+	  level 2:   6.8 min slots, 7.3 h range
+	  level 3:   7.3 h slots, 19 days range (longer delays are capped)
+	Entries of a higher level are moved down when the level below wraps
+	around, so every entry is moved at most levels - 1 times.
+
+	Entries are intrusive list nodes owned by the user, which makes
+	schedule() and Entry::cancel() O(1) without any allocation. The
+	callback is called from the event loop, after the entry was removed
+	from the wheel; it may schedule the entry again.
+*/
+class TimerWheel
+{
+private:
+	struct Link
+	{
+		Link* prev = nullptr;
+		Link* next = nullptr;
+	};
+
+public:
+	class Entry : private Link
+	{
+	public:
+		explicit Entry( std::function<void()> on_expire ) : m_on_expire( std::move( on_expire ) ) {};
+		~Entry() { cancel(); };
+		Entry( const Entry& ) = delete;
+		Entry& operator =( const Entry& ) = delete;
+
+		bool scheduled() const { return nullptr != prev; };
+		void cancel();
+
+	private:
+		friend class TimerWheel;
+		TimerWheel*           m_wheel  = nullptr;
+		unsigned long long    m_expiry = 0;//tick number
+		std::function<void()> m_on_expire;
+	};
+
+	enum { tick_ms         = 100 };
+	enum { slot_bits       = 6   };
+	enum { slots_per_level = 1 << slot_bits };
+	enum { levels          = 4   };
+
+	TimerWheel( asio::io_service& io_service );
+	~TimerWheel();
+
+	//(re)schedules the entry to expire after delay, rounded up to ticks
+	void schedule( Entry& entry, std::chrono::milliseconds delay );
+
+	//time of the last tick; cheap, but only as precise as tick_ms
+	std::chrono::steady_clock::time_point now() const { return m_armed ? m_now : std::chrono::steady_clock::now(); };
+
+	size_t size() const { return m_size; };
+
+private:
+	void place( Entry& entry );
+	unsigned int cascade( unsigned int level );
+	void arm();
+	void do_tick();
+	void advance();
+
+	asio::steady_timer m_timer;
+	bool               m_armed;
+
+	Link   m_slots[levels][slots_per_level];//list heads
+	size_t m_size;
+
+	//next tick to process and its time
+	unsigned long long                    m_tick;
+	std::chrono::steady_clock::time_point m_now;
+};
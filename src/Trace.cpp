@@ -0,0 +1,57 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#include "Player.hpp"
+#include "Room.hpp"
+#include "SendBuffer.hpp"
+#include "Session.hpp"
+#include "Trace.hpp"
+
+#ifndef NTRACE
+static void print_counters( std::ostream& out, const char* name, const TraceCounters& c )
+{
+	out << std::dec << std::setfill( ' ' ) << std::left << std::setw( 14 ) << name << std::right
+	    << std::setw( 8 )  << c.live
+	    << std::setw( 8 )  << c.peak
+	    << std::setw( 10 ) << c.total
+	    << std::setw( 12 ) << c.bytes
+	    << std::setw( 12 ) << c.peak_bytes << '\n';
+}
+#endif
+
+
+/*
+	Prints live, peak and total instance counts together with the byte
+	counters for all traced types. Bytes are:
+	  Session     receive buffers
+	  SendBuffer  allocated send buffers (shared between Sessions)
+	  send pool   free send buffer blocks kept for reuse
+	  send queues queued send bytes summed over all Sessions
+	  Interned    distinct interned strings (versions, properties, room info)
+*/
+void print_trace_report( std::ostream& out )
+{
+#ifdef NTRACE
+	out << "Object accounting disabled (compiled with NTRACE)\n";
+#else
+	out << std::left << std::setw( 14 ) << "type" << std::right
+	    << std::setw( 8 )  << "live"
+	    << std::setw( 8 )  << "peak"
+	    << std::setw( 10 ) << "total"
+	    << std::setw( 12 ) << "bytes"
+	    << std::setw( 12 ) << "peak bytes" << '\n';
+	print_counters( out, "Session",     Trace<Session>   ::counters() );
+	print_counters( out, "Player",      Trace<Player>    ::counters() );
+	print_counters( out, "Room",        Trace<Room>      ::counters() );
+	print_counters( out, "SendBuffer",  Trace<SendBuffer>::counters() );
+	print_counters( out, "send pool",   Trace<PooledSendBuffer>::counters() );
+	print_counters( out, "send queues", Trace<QueuedSend>::counters() );
+	print_counters( out, "Interned",    Trace<Interned>::counters() );
+#endif
+	out << std::flush;
+}
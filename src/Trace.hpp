@@ -5,12 +5,13 @@
 	See LICENSE.MIT for details.
 */
 #pragma once
-#include <iostream>
-#include <typeinfo>
+#include <atomic>
+#include <cstddef>
+#include <iosfwd>
 
 /*
-	A debugging class for tracing object creation and destruction.
-	To trace a class, add a member variable	of the type Trace<ClassName>:
+	Object and memory accounting. To count live instances of a class,
+	add a member variable of the type Trace<ClassName>:
 
 	#include "Trace.hpp"
 	class Room
@@ -19,23 +20,92 @@
 	private:
 		Trace<Room> t;
 	};
+
+	Every traced type keeps atomic counters for live, peak and total
+	instances, plus a byte counter which has to be maintained manually
+	through add_bytes() and sub_bytes() (e.g. for buffers owned by the
+	instances). Use Trace<T>::counters() to query the values at runtime
+	and print_trace_report() to print all traced types.
+
+	Compile with NTRACE defined to turn all accounting into no-ops.
 */
+struct TraceCounters
+{
+	long long          live;
+	long long          peak;
+	unsigned long long total;
+	long long          bytes;
+	long long          peak_bytes;
+};
+
+#ifndef NTRACE
+
 template<typename T>
 class Trace
 {
+public:
+	Trace()               { construct(); };
+	Trace( const Trace& ) { construct(); };
+	Trace( Trace&&      ) { construct(); };
+	Trace& operator =( const Trace& ) { return *this; };
+	Trace& operator =( Trace&&      ) { return *this; };
+	~Trace() { s_live.fetch_sub( 1, std::memory_order_relaxed ); };
+
+	static void add_bytes( size_t n )
+	{
+		const auto b = s_bytes.fetch_add( static_cast<long long>( n ), std::memory_order_relaxed ) + n;
+		raise( s_peak_bytes, static_cast<long long>( b ) );
+	};
+	static void sub_bytes( size_t n ) { s_bytes.fetch_sub( static_cast<long long>( n ), std::memory_order_relaxed ); };
+
+	static TraceCounters counters()
+	{
+		return TraceCounters{ s_live      .load( std::memory_order_relaxed ),
+		                      s_peak      .load( std::memory_order_relaxed ),
+		                      s_total     .load( std::memory_order_relaxed ),
+		                      s_bytes     .load( std::memory_order_relaxed ),
+		                      s_peak_bytes.load( std::memory_order_relaxed ) };
+	};
+
 private:
-	inline void out( const std::string& action )
+	static void construct()
+	{
+		s_total.fetch_add( 1, std::memory_order_relaxed );
+		raise( s_peak, s_live.fetch_add( 1, std::memory_order_relaxed ) + 1 );
+	};
+	//lock-free maximum
+	static void raise( std::atomic<long long>& peak, long long value )
 	{
-		std::cout << "Object " << typeid( T ).name() << " #" << id << " " << action << std::endl;
+		auto p = peak.load( std::memory_order_relaxed );
+		while ( p < value && !peak.compare_exchange_weak( p, value, std::memory_order_relaxed ) );
 	};
-	static int c;//global incremental object counter (separate for every type T)
-	int       id;//local copy of the obejct number
+
+	//separate counters for every type T
+	static std::atomic<long long>          s_live;
+	static std::atomic<long long>          s_peak;
+	static std::atomic<unsigned long long> s_total;
+	static std::atomic<long long>          s_bytes;
+	static std::atomic<long long>          s_peak_bytes;
+};
+//necessary for the linker to resolve static symbols
+template<typename T> std::atomic<long long>          Trace<T>::s_live( 0 );
+template<typename T> std::atomic<long long>          Trace<T>::s_peak( 0 );
+template<typename T> std::atomic<unsigned long long> Trace<T>::s_total( 0 );
+template<typename T> std::atomic<long long>          Trace<T>::s_bytes( 0 );
+template<typename T> std::atomic<long long>          Trace<T>::s_peak_bytes( 0 );
+
+#else
+
+template<typename T>
+class Trace
+{
 public:
-	Trace()               : id( ++c ) { out( "constructed"      ); };
-	Trace( const Trace& ) : id( ++c ) { out( "copy-constructed" ); };
-	Trace( Trace&&      ) : id( ++c ) { out( "move-constructed" ); };
-	Trace& operator =( const Trace& ) { out( "copied through =" ); return *this; };
-	Trace& operator =( Trace&&      ) { out( "moved through ="  ); return *this; };
-	~Trace() { out( "destroyed" ); };
+	static void add_bytes( size_t ) {};
+	static void sub_bytes( size_t ) {};
+	static TraceCounters counters() { return TraceCounters{}; };
 };
-template<typename T> int Trace<T>::c = 0;//necessary for the linker to resolve static symbol
+
+#endif
+
+//prints counters of all traced types, see Trace.cpp
+void print_trace_report( std::ostream& out );
@@ -0,0 +1,119 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#include "Precompiled.hpp"
+
+#if defined( __linux__ )
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "ZeroCopy.hpp"
+
+static unsigned long long s_sends     = 0;
+static unsigned long long s_bytes     = 0;
+static unsigned long long s_completed = 0;//send calls reported done
+static unsigned long long s_copied    = 0;//of these, copied by the kernel anyway
+
+#if defined( MSG_ZEROCOPY ) && defined( SO_ZEROCOPY ) && defined( SO_EE_ORIGIN_ZEROCOPY )
+
+const int ZeroCopy::send_flag = MSG_ZEROCOPY;
+
+
+bool ZeroCopy::use( int fd, const SendBuffer& buf )
+{
+	if ( 0 == m_min_size || buf.size() < m_min_size || Unsupported == m_state ) return false;
+	if ( Off == m_state )
+	{
+		const int one = 1;
+		m_state = 0 == ::setsockopt( fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof( one ) ) ? On : Unsupported;
+	}
+	return On == m_state;
+}
+
+
+void ZeroCopy::start( const BufPtr& buf )
+{
+	m_pending.emplace_back( m_next_id++, buf );
+}
+
+
+/*
+	A call which sent nothing does not use up its ID and gets no
+	notification, its entry is still the last one.
+*/
+void ZeroCopy::done( size_t bytes_sent )
+{
+	if ( 0 == bytes_sent )
+	{
+		m_pending.pop_back();
+		--m_next_id;
+		return;
+	}
+	++s_sends;
+	s_bytes += bytes_sent;
+}
+
+
+/*
+	Every notification covers a range of send call IDs [ee_info, ee_data].
+	Completions usually come in order, but the range check also handles
+	gaps and the wrap around of the 32 bit IDs.
+*/
+void ZeroCopy::reap( int fd )
+{
+	while ( !m_pending.empty() )
+	{
+		char control[CMSG_SPACE( sizeof( sock_extended_err ) ) + 64] = {};
+		msghdr msg = {};
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof( control );
+		if ( -1 == ::recvmsg( fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT ) ) return;
+
+		for ( cmsghdr* cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+		{
+			const bool recverr = ( SOL_IP   == cmsg->cmsg_level && IP_RECVERR   == cmsg->cmsg_type )
+			                  || ( SOL_IPV6 == cmsg->cmsg_level && IPV6_RECVERR == cmsg->cmsg_type );
+			if ( !recverr ) continue;
+
+			sock_extended_err err;
+			std::memcpy( &err, CMSG_DATA( cmsg ), sizeof( err ) );
+			if ( SO_EE_ORIGIN_ZEROCOPY != err.ee_origin || 0 != err.ee_errno ) continue;
+
+			const unsigned int lo = err.ee_info;
+			const unsigned int hi = err.ee_data;
+			const auto done = [lo, hi]( const std::pair<unsigned int, BufPtr>& p ) { return p.first - lo <= hi - lo; };
+			const auto it   = std::remove_if( m_pending.begin(), m_pending.end(), done );
+			const auto n    = static_cast<unsigned long long>( m_pending.end() - it );
+			m_pending.erase( it, m_pending.end() );
+			s_completed += n;
+			if ( err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) s_copied += n;
+		}
+	}
+}
+
+#else //no MSG_ZEROCOPY
+
+const int ZeroCopy::send_flag = 0;
+bool ZeroCopy::use( int, const SendBuffer& ) { return false; }
+void ZeroCopy::start( const BufPtr& ) {}
+void ZeroCopy::done( size_t ) {}
+void ZeroCopy::reap( int ) {}
+
+#endif
+
+
+/*
+	Copied sends mean the kernel could not send from user memory (e.g. on
+	loopback or without NIC scatter-gather support); the option then only
+	adds overhead.
+*/
+void ZeroCopy::print( std::ostream& out )
+{
+	out << "zero copy sends: " << s_sends << " (" << ( s_bytes >> 10 ) << " KiB), completed "
+	    << s_completed << ", copied by the kernel " << s_copied << "\n";
+}
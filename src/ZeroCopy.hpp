@@ -0,0 +1,58 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+#pragma once
+#include "Precompiled.hpp"
+
+#include "SendBuffer.hpp"
+
+/*
+	MSG_ZEROCOPY sends for big buffers (Linux 4.14 and later, enabled with
+	--zerocopy-min). The kernel sends straight from the SendBuffer instead
+	of copying it into every socket's send buffer, which matters for map
+	data broadcast to a whole room. In exchange the buffer must stay
+	untouched until the kernel reports completion through the socket
+	error queue, so every such send keeps a reference here until reap()
+	reads the notification.
+
+	One instance per Session. Small packets keep the normal path, the
+	notification round trip costs more than copying them.
+*/
+class ZeroCopy
+{
+public:
+	//min_size 0: disabled
+	explicit ZeroCopy( size_t min_size ) : m_min_size( min_size ), m_state( Off ), m_next_id( 0 ) {};
+
+	//true if buf should be sent with send_flag; enables SO_ZEROCOPY on fd first
+	bool use( int fd, const SendBuffer& buf );
+	static const int send_flag;
+
+	//called before and after every zero copy send call. The ID is taken
+	//first: on loopback the completion may be queued before the send
+	//handler runs, and an error queue wait may read it in between
+	void start( const BufPtr& buf );
+	void  done( size_t bytes_sent );
+	//reads all completion notifications of fd, releases the buffers
+	void reap( int fd );
+
+	bool pending() const { return !m_pending.empty(); };
+
+	//hot restart: the kernel keeps counting on the handed over socket
+	unsigned int next_id() const { return m_next_id; };
+	void set_next_id( unsigned int id ) { m_next_id = id; };
+
+	//sends, completions and kernel fallbacks to copying, all Sessions
+	static void print( std::ostream& out );
+
+private:
+	const size_t m_min_size;
+	enum State { Off, On, Unsupported } m_state;
+
+	//the kernel numbers zero copy send calls per socket, starting with 0
+	unsigned int m_next_id;
+	std::deque<std::pair<unsigned int, BufPtr>> m_pending;
+};
@@ -0,0 +1,476 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+
+/*
+	TCP proxy which makes a loopback connection behave like a bad LAN
+	link, for testing the server with cossacks3-load:
+
+	$ cossacks3-impair [options] LISTEN_PORT SERVER_HOST:SERVER_PORT
+
+	Every accepted connection is forwarded to the server. Both directions
+	of a connection get the same impairment, but their own random
+	sequence (seeded with --seed and the connection number, so runs are
+	repeatable):
+
+	- every chunk read is delayed by --delay plus up to --jitter ms; the
+	  byte order is kept, so a late chunk also holds back the next ones
+	- --rate caps the throughput of each direction; what can not be sent
+	  yet is held, up to --buffer bytes (plus as much in the socket
+	  buffers), then the proxy stops reading and the sender's socket
+	  buffers and send queue fill up as they would
+	- --stall-every makes the link stop forwarding in both directions for
+	  --stall ms, at random intervals of that mean length
+	- --reset-after aborts the connection with a TCP reset to both ends
+
+	Single threaded, one asio event loop.
+*/
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+
+using asio::ip::tcp;
+typedef std::chrono::steady_clock Clock;
+
+
+struct Impairment
+{
+	unsigned int delay_ms     = 0;
+	unsigned int jitter_ms    = 0;
+	unsigned int rate_kbit    = 0;//0: unlimited
+	unsigned int buffer_bytes = 64 * 1024;
+	double       stall_every  = 0;//seconds, mean; 0: never
+	unsigned int stall_ms     = 1000;
+	double       reset_after  = 0;//seconds; 0: never
+	unsigned int seed         = 1;
+};
+
+
+class Link;
+
+/*
+	One direction of a Link: reads chunks from one socket, and writes
+	them to the other one when they are due.
+*/
+class Pipe
+{
+public:
+	Pipe( asio::io_service& io_service, Link& link, tcp::socket& from, tcp::socket& to );
+
+	void do_read();
+	//link stall or end: re-evaluate when the front chunk can go
+	void do_write();
+
+	unsigned long long bytes()      const { return m_bytes;      };
+	size_t             max_queued() const { return m_max_queued; };
+	bool               finished()   const { return m_finished;   };
+
+private:
+	enum { chunk_size = 16 * 1024 };
+
+	struct Chunk
+	{
+		std::vector<char> data;
+		Clock::time_point due;
+	};
+
+	Link&        m_link;
+	tcp::socket& m_from;
+	tcp::socket& m_to;
+
+	std::vector<char>  m_read_buf;
+	std::deque<Chunk>  m_chunks;
+	size_t             m_queued;
+	Clock::time_point  m_link_free;//end of the last transmission at --rate
+	Clock::time_point  m_last_due;
+	asio::steady_timer m_timer;
+	Clock::time_point  m_wait_until;
+	bool m_reading;
+	bool m_writing;
+	bool m_waiting;
+	bool m_eof;
+	bool m_finished;
+
+	unsigned long long m_bytes;
+	size_t             m_max_queued;
+};
+
+
+/*
+	An accepted connection and its connection to the server.
+*/
+class Link : public std::enable_shared_from_this<Link>
+{
+public:
+	Link( asio::io_service& io_service, tcp::socket client, unsigned int number, const Impairment& impairment ) :
+		m_client     ( std::move( client ) ),
+		m_server     ( io_service ),
+		m_number     ( number ),
+		m_impairment ( impairment ),
+		m_random     ( impairment.seed * 7919u + number ),
+		m_up         ( io_service, *this, m_client, m_server ),
+		m_down       ( io_service, *this, m_server, m_client ),
+		m_stall_timer( io_service ),
+		m_reset_timer( io_service ),
+		m_stall_until( Clock::now() ),
+		m_stalls     ( 0 ),
+		m_closed     ( false ),
+		m_opened     ( Clock::now() )
+	{};
+
+	void start( const tcp::endpoint& server )
+	{
+		//before connecting, or the window is scaled for the default buffer
+		asio::error_code ec;
+		m_server.open( server.protocol(), ec );
+		m_server.set_option( asio::socket_base::receive_buffer_size( m_impairment.buffer_bytes ), ec );
+		m_server.set_option( asio::socket_base::send_buffer_size   ( m_impairment.buffer_bytes ), ec );
+		auto self( shared_from_this() );
+		m_server.async_connect( server,
+		[this, self]( asio::error_code ec )
+		{
+			if ( ec )
+			{
+				std::cerr << "#" << m_number << " could not connect to server: " << ec.message() << "\n";
+				close( true );
+				return;
+			}
+			asio::error_code ignored;
+			m_client.set_option( tcp::no_delay( true ), ignored );
+			m_server.set_option( tcp::no_delay( true ), ignored );
+			std::cout << "#" << m_number << " open" << std::endl;
+			m_up.do_read();
+			m_down.do_read();
+			schedule_stall();
+			if ( 0 < m_impairment.reset_after )
+			{
+				m_reset_timer.expires_from_now( std::chrono::milliseconds( static_cast<long long>( m_impairment.reset_after * 1000 ) ) );
+				m_reset_timer.async_wait( [this, self]( asio::error_code ec ) { if ( !ec ) close( true ); } );
+			}
+		} );
+	}
+
+	//one direction reached its end, the link closes when both did
+	void finished()
+	{
+		if ( m_up.finished() && m_down.finished() ) close( false );
+	}
+
+	//reset: abortive close, both ends get a TCP reset
+	void close( bool reset )
+	{
+		if ( m_closed ) return;
+		m_closed = true;
+		asio::error_code ec;
+		if ( reset )
+		{
+			m_client.set_option( asio::socket_base::linger( true, 0 ), ec );
+			m_server.set_option( asio::socket_base::linger( true, 0 ), ec );
+		}
+		m_client.close( ec );
+		m_server.close( ec );
+		m_stall_timer.cancel();
+		m_reset_timer.cancel();
+
+		const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>( Clock::now() - m_opened ).count();
+		std::cout << "#" << m_number << ( reset ? " reset" : " closed" ) << " after " << ms << " ms: up "
+		          << m_up.bytes() << " bytes (max held " << m_up.max_queued() << "), down "
+		          << m_down.bytes() << " bytes (max held " << m_down.max_queued() << "), "
+		          << m_stalls << " stalls" << std::endl;
+	}
+
+	bool closed() const { return m_closed; };
+
+	const Impairment& impairment() const { return m_impairment; };
+	std::mt19937&     random()           { return m_random;     };
+	Clock::time_point stall_until() const { return m_stall_until; };
+
+private:
+	void schedule_stall()
+	{
+		if ( 0 >= m_impairment.stall_every || m_closed ) return;
+		std::exponential_distribution<double> interval( 1.0 / m_impairment.stall_every );
+		m_stall_timer.expires_from_now( std::chrono::milliseconds( static_cast<long long>( interval( m_random ) * 1000 ) ) );
+		auto self( shared_from_this() );
+		m_stall_timer.async_wait(
+		[this, self]( asio::error_code ec )
+		{
+			if ( ec || m_closed ) return;
+			++m_stalls;
+			m_stall_until = Clock::now() + std::chrono::milliseconds( m_impairment.stall_ms );
+			m_up.do_write();
+			m_down.do_write();
+			schedule_stall();
+		} );
+	}
+
+	tcp::socket        m_client;
+	tcp::socket        m_server;
+	const unsigned int m_number;
+	const Impairment&  m_impairment;
+	std::mt19937       m_random;
+	Pipe               m_up;  //client -> server
+	Pipe               m_down;//server -> client
+	asio::steady_timer m_stall_timer;
+	asio::steady_timer m_reset_timer;
+	Clock::time_point  m_stall_until;
+	unsigned int       m_stalls;
+	bool               m_closed;
+	const Clock::time_point m_opened;
+};
+
+
+Pipe::Pipe( asio::io_service& io_service, Link& link, tcp::socket& from, tcp::socket& to ) :
+	m_link      ( link ),
+	m_from      ( from ),
+	m_to        ( to ),
+	m_read_buf  ( chunk_size ),
+	m_queued    ( 0 ),
+	m_link_free ( Clock::now() ),
+	m_last_due  ( m_link_free ),
+	m_timer     ( io_service ),
+	m_reading   ( false ),
+	m_writing   ( false ),
+	m_waiting   ( false ),
+	m_eof       ( false ),
+	m_finished  ( false ),
+	m_bytes     ( 0 ),
+	m_max_queued( 0 )
+{
+}
+
+
+/*
+	Reading pauses while --buffer bytes are held and resumes when
+	do_write() got rid of some.
+*/
+void Pipe::do_read()
+{
+	if ( m_reading || m_eof || m_link.closed() || m_link.impairment().buffer_bytes <= m_queued ) return;
+	m_reading = true;
+	auto self( m_link.shared_from_this() );
+	m_from.async_read_some( asio::buffer( m_read_buf ),
+	[this, self]( asio::error_code ec, size_t size )
+	{
+		m_reading = false;
+		if ( m_link.closed() ) return;
+		if ( ec )
+		{
+			if ( asio::error::eof != ec )
+			{
+				//pass a broken connection on as such
+				m_link.close( true );
+				return;
+			}
+			m_eof = true;
+			do_write();
+			return;
+		}
+
+		const auto& im = m_link.impairment();
+		const auto now = Clock::now();
+		//serialization at --rate, then propagation delay and jitter
+		if ( im.rate_kbit )
+		{
+			m_link_free = std::max( m_link_free, now ) + std::chrono::microseconds( size * 8 * 1000 / im.rate_kbit );
+		}
+		else
+		{
+			m_link_free = now;
+		}
+		auto due = m_link_free + std::chrono::milliseconds( im.delay_ms );
+		if ( im.jitter_ms )
+		{
+			std::uniform_int_distribution<unsigned int> jitter( 0, im.jitter_ms * 1000 );
+			due += std::chrono::microseconds( jitter( m_link.random() ) );
+		}
+		due = std::max( due, m_last_due );
+		m_last_due = due;
+
+		m_chunks.push_back( Chunk{ std::vector<char>( m_read_buf.begin(), m_read_buf.begin() + size ), due } );
+		m_queued    += size;
+		m_bytes     += size;
+		m_max_queued = std::max( m_max_queued, m_queued );
+		do_write();
+		do_read();
+	} );
+}
+
+
+void Pipe::do_write()
+{
+	if ( m_writing || m_link.closed() ) return;
+	if ( m_chunks.empty() )
+	{
+		if ( m_eof && !m_finished )
+		{
+			m_finished = true;
+			asio::error_code ec;
+			m_to.shutdown( tcp::socket::shutdown_send, ec );
+			m_link.finished();
+		}
+		return;
+	}
+
+	const auto now  = Clock::now();
+	const auto when = std::max( m_chunks.front().due, m_link.stall_until() );
+	auto self( m_link.shared_from_this() );
+	if ( now < when )
+	{
+		if ( m_waiting && when == m_wait_until ) return;
+		m_waiting    = true;
+		m_wait_until = when;
+		m_timer.expires_at( when );
+		m_timer.async_wait(
+		[this, self]( asio::error_code ec )
+		{
+			if ( ec ) return;//replaced by a later wait
+			m_waiting = false;
+			do_write();
+		} );
+		return;
+	}
+
+	m_writing = true;
+	asio::async_write( m_to, asio::buffer( m_chunks.front().data ),
+	[this, self]( asio::error_code ec, size_t size )
+	{
+		m_writing = false;
+		if ( m_link.closed() ) return;
+		if ( ec )
+		{
+			m_link.close( true );
+			return;
+		}
+		m_queued -= size;
+		m_chunks.pop_front();
+		do_write();
+		do_read();
+	} );
+}
+
+
+struct Proxy
+{
+	/*
+		The socket buffers of both sockets of a Link are limited to
+		--buffer as well, the kernel would hold megabytes more otherwise.
+		Accepted sockets inherit the sizes from the listening one.
+	*/
+	Proxy( asio::io_service& io_service, unsigned short port, const tcp::endpoint& server, const Impairment& impairment ) :
+		io_service( io_service ),
+		acceptor  ( io_service ),
+		socket    ( io_service ),
+		server    ( server ),
+		impairment( impairment ),
+		count     ( 0 )
+	{
+		const tcp::endpoint ep( tcp::v4(), port );
+		acceptor.open( ep.protocol() );
+		acceptor.set_option( tcp::acceptor::reuse_address( true ) );
+		acceptor.set_option( asio::socket_base::receive_buffer_size( impairment.buffer_bytes ) );
+		acceptor.set_option( asio::socket_base::send_buffer_size   ( impairment.buffer_bytes ) );
+		acceptor.bind( ep );
+		acceptor.listen();
+		do_accept();
+	};
+
+	void do_accept()
+	{
+		acceptor.async_accept( socket,
+		[this]( asio::error_code ec )
+		{
+			if ( !ec ) std::make_shared<Link>( io_service, std::move( socket ), ++count, impairment )->start( server );
+			do_accept();
+		} );
+	}
+
+	asio::io_service&    io_service;
+	tcp::acceptor        acceptor;
+	tcp::socket          socket;
+	const tcp::endpoint  server;
+	const Impairment&    impairment;
+	unsigned int         count;
+};
+
+
+static void print_usage()
+{
+	std::cerr << "Usage: cossacks3-impair [options] LISTEN_PORT SERVER_HOST:SERVER_PORT\n"
+	          << "  --delay MS        delay of each direction (default 0)\n"
+	          << "  --jitter MS       additional random delay of up to MS (default 0)\n"
+	          << "  --rate KBIT       throughput cap of each direction in kbit/s (default 0: none)\n"
+	          << "  --buffer BYTES    data held per direction before reading stops (default 65536)\n"
+	          << "  --stall-every S   stop forwarding at random intervals of S seconds on average\n"
+	          << "  --stall MS        length of a stall (default 1000)\n"
+	          << "  --reset-after S   reset each connection S seconds after it was opened\n"
+	          << "  --seed N          seed of the random sequences (default 1)\n";
+}
+
+
+int main( int argc, char* argv[] )
+{
+	Impairment im;
+	std::vector<std::string> args;
+	for ( int i = 1; argc > i; ++i )
+	{
+		const std::string arg( argv[i] );
+		if ( 0 != arg.compare( 0, 2, "--" ) )
+		{
+			args.push_back( arg );
+			continue;
+		}
+		if ( argc <= i + 1 )
+		{
+			print_usage();
+			return 2;
+		}
+		const char* value = argv[++i];
+		if      ( "--delay"       == arg ) im.delay_ms     = std::atoi( value );
+		else if ( "--jitter"      == arg ) im.jitter_ms    = std::atoi( value );
+		else if ( "--rate"        == arg ) im.rate_kbit    = std::atoi( value );
+		else if ( "--buffer"      == arg ) im.buffer_bytes = std::max( 1, std::atoi( value ) );
+		else if ( "--stall-every" == arg ) im.stall_every  = std::atof( value );
+		else if ( "--stall"       == arg ) im.stall_ms     = std::atoi( value );
+		else if ( "--reset-after" == arg ) im.reset_after  = std::atof( value );
+		else if ( "--seed"        == arg ) im.seed         = std::atoi( value );
+		else
+		{
+			print_usage();
+			return 2;
+		}
+	}
+	const auto colon = 2 == args.size() ? args[1].rfind( ':' ) : std::string::npos;
+	if ( std::string::npos == colon )
+	{
+		print_usage();
+		return 2;
+	}
+
+	try
+	{
+		asio::io_service io_service;
+		tcp::resolver resolver( io_service );
+		const tcp::endpoint server = *resolver.resolve( args[1].substr( 0, colon ), args[1].substr( colon + 1 ) ).begin();
+
+		Proxy proxy( io_service, static_cast<unsigned short>( std::atoi( args[0].c_str() ) ), server, im );
+		io_service.run();
+	}
+	catch ( const std::exception& e )
+	{
+		std::cerr << "[ERROR] " << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,749 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+
+/*
+	Load generator: plays games on a server like real clients do and
+	measures how the server relays under load, usually through
+	cossacks3-impair to simulate bad links:
+
+	$ cossacks3-load [options] SERVER_HOST:SERVER_PORT
+
+	It logs in --rooms times --players clients, lets the first one of each
+	group create a room, the others join it, and starts the game. For
+	--duration seconds every player then sends --size bytes of 0x4b0 game
+	data --rate times per second and acknowledges received game data with
+	0x456, like the game does. The relay latency (from sending to
+	receiving through the server) is measured with a timestamp in the
+	game data. Every second a line with the latencies of that second is
+	printed, and with --stats-shm also the server's send queue (see
+	StatsSegment in the server).
+
+	With --transfer the hosts crash at the end: "reset" closes their
+	connections with a TCP reset, "silent" stops reading and sending but
+	keeps the connections open (a frozen PC, or a pulled cable behind
+	cossacks3-impair with a long stall). The time until the remaining
+	players are told the new host (0x1bd and 0x1be, see 0x1a0 in Lobby)
+	is measured per room.
+
+	--hosts-via connects the hosts to another address than the other
+	players, e.g. a second cossacks3-impair with other impairments.
+
+	All clients connect from the same address: start the server with a
+	high enough --max-per-address.
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+
+#include "../src/SharedStats.hpp"
+
+using asio::ip::tcp;
+typedef std::chrono::steady_clock Clock;
+
+enum { header_size = 14 };
+
+struct Settings
+{
+	unsigned int rooms       = 4;
+	unsigned int players     = 4;//per room, host included
+	unsigned int rate        = 20;//game data packets per player and second
+	unsigned int size        = 100;//bytes of game data
+	unsigned int duration    = 10;//seconds
+	unsigned int timeout     = 30;//seconds for setup and host transfer
+	std::string  transfer;//empty, reset or silent
+	std::string  stats_shm;
+	tcp::endpoint server;
+	tcp::endpoint hosts_via;
+};
+
+
+static long long us_since( Clock::time_point t )
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - t ).count();
+}
+
+
+/*
+	Latency samples of one interval or of the whole run.
+*/
+class Latencies
+{
+public:
+	void add( long long us ) { m_samples.push_back( us ); };
+	void add( const Latencies& other ) { m_samples.insert( m_samples.end(), other.m_samples.begin(), other.m_samples.end() ); };
+	void clear() { m_samples.clear(); };
+	size_t count() const { return m_samples.size(); };
+
+	//in ms, with p in per mille
+	double percentile( unsigned int p )
+	{
+		if ( m_samples.empty() ) return 0;
+		const size_t n = std::min( m_samples.size() - 1, m_samples.size() * p / 1000 );
+		std::nth_element( m_samples.begin(), m_samples.begin() + n, m_samples.end() );
+		return m_samples[n] / 1000.0;
+	}
+
+private:
+	std::vector<long long> m_samples;
+};
+
+
+class Scenario;
+
+/*
+	One simulated game client.
+*/
+class Player : public std::enable_shared_from_this<Player>
+{
+public:
+	Player( asio::io_service& io_service, Scenario& scenario, unsigned int room, unsigned int index ) :
+		m_scenario( scenario ),
+		m_socket  ( io_service ),
+		m_timer   ( io_service ),
+		m_room    ( room ),
+		m_index   ( index ),
+		m_id      ( 0 ),
+		m_buf     ( header_size ),
+		m_writing ( false ),
+		m_playing ( false ),
+		m_crashed ( false )
+	{};
+
+	void start( const tcp::endpoint& server );
+	//starts the game as host, see Scenario::joined()
+	void start_game( const std::vector<unsigned int>& ids );
+	void stop();
+	void crash( bool reset );
+
+	unsigned int id()      const { return m_id;      };
+	unsigned int room()    const { return m_room;    };
+	bool         is_host() const { return 0 == m_index; };
+
+	void send( unsigned short cmd, unsigned int id1, unsigned int id2, const std::string& body = std::string() );
+
+private:
+	enum { silent_receive_buffer = 4096 };
+
+	void do_read_header();
+	void do_read_body( size_t size );
+	void do_write();
+	void handle( unsigned short cmd, unsigned int id1, unsigned int id2, const unsigned char* data, size_t size );
+	void tick();
+
+	Scenario&          m_scenario;
+	tcp::socket        m_socket;
+	asio::steady_timer m_timer;
+	const unsigned int m_room;
+	const unsigned int m_index;
+	unsigned int       m_id;
+	std::vector<unsigned char> m_buf;
+	std::deque<std::string>    m_queue;
+	bool m_writing;
+	bool m_playing;
+	bool m_crashed;
+};
+
+
+/*
+	Drives the rooms through login, room creation, joining, the game
+	and the host transfer, and prints the measurements.
+*/
+class Scenario
+{
+public:
+	Scenario( asio::io_service& io_service, const Settings& settings );
+
+	const Settings& settings() const { return m_settings; };
+
+	void logged_in  ( Player& player );
+	void created    ( unsigned int room );
+	void joined     ( unsigned int room, unsigned int id );
+	void started    ( Player& player );
+	void relayed    ( long long us ) { m_interval.add( us ); };
+	//a remaining player got 0x1bd (is the new host) or 0x1be
+	void new_host   ( unsigned int room, bool is_new_host );
+	void failed     ( const Player& player, const std::string& what );
+
+	unsigned int host_id( unsigned int room ) const { return m_rooms[room].players[0]->id(); };
+
+	unsigned long long sent;
+	unsigned long long received;
+
+private:
+	struct Room
+	{
+		std::vector<std::shared_ptr<Player>> players;
+		unsigned int      logged_in = 0;
+		unsigned int      joined = 0;
+		unsigned int      informed = 0;//of the new host
+		Clock::time_point crashed;
+		long long         new_host_us  = -1;//until the new host got 0x1bd
+		long long         transfer_us  = -1;//until all remaining players got 0x1bd or 0x1be
+	};
+
+	void every_second();
+	void end_game();
+	void finish();
+	//samples the server statistics segment, false if there is none
+	bool sample_server( SharedStats::Data& data ) const;
+
+	asio::io_service&  m_io_service;
+	const Settings&    m_settings;
+	std::vector<Room>  m_rooms;
+	asio::steady_timer m_timer;
+	unsigned int       m_playing;
+	unsigned int       m_second;
+	bool               m_transferring;
+	Clock::time_point  m_deadline;
+
+	Latencies          m_interval;
+	Latencies          m_total;
+	unsigned long long m_max_queued_bytes;
+
+	const SharedStats* m_stats;
+};
+
+
+/*
+	Hosts which are going to freeze get a small receive buffer: their
+	kernel keeps acknowledging, and with the default buffers the server
+	could send for minutes before it notices anything.
+*/
+void Player::start( const tcp::endpoint& server )
+{
+	if ( is_host() && "silent" == m_scenario.settings().transfer )
+	{
+		asio::error_code ec;
+		m_socket.open( server.protocol(), ec );
+		m_socket.set_option( asio::socket_base::receive_buffer_size( silent_receive_buffer ), ec );
+	}
+	auto self( shared_from_this() );
+	m_socket.async_connect( server,
+	[this, self]( asio::error_code ec )
+	{
+		if ( ec )
+		{
+			m_scenario.failed( *this, "connect: " + ec.message() );
+			return;
+		}
+		asio::error_code ignored;
+		m_socket.set_option( tcp::no_delay( true ), ignored );
+
+		//0x19a login: version strings, e-mail, password, nickname
+		const std::string name = "load" + std::to_string( m_room ) + "p" + std::to_string( m_index );
+		std::string body;
+		for ( const std::string& s : { std::string( "1.0.0.7" ), std::string( "2.0.7" ), std::string(), std::string(), name } )
+		{
+			body += static_cast<char>( s.size() );
+			body += s;
+		}
+		send( 0x19a, 0, 0, body );
+		do_read_header();
+	} );
+}
+
+
+void Player::send( unsigned short cmd, unsigned int id1, unsigned int id2, const std::string& body )
+{
+	if ( m_crashed ) return;
+	std::string packet( header_size, '\0' );
+	const uint32_t size = static_cast<uint32_t>( body.size() );
+	std::memcpy( &packet[0],  &size, 4 );
+	std::memcpy( &packet[4],  &cmd,  2 );
+	std::memcpy( &packet[6],  &id1,  4 );
+	std::memcpy( &packet[10], &id2,  4 );
+	m_queue.push_back( packet + body );
+	do_write();
+}
+
+
+void Player::do_write()
+{
+	if ( m_writing || m_queue.empty() || m_crashed ) return;
+	m_writing = true;
+	auto self( shared_from_this() );
+	asio::async_write( m_socket, asio::buffer( m_queue.front() ),
+	[this, self]( asio::error_code ec, size_t )
+	{
+		m_writing = false;
+		if ( ec )
+		{
+			if ( !m_crashed ) m_scenario.failed( *this, "send: " + ec.message() );
+			return;
+		}
+		m_queue.pop_front();
+		do_write();
+	} );
+}
+
+
+void Player::do_read_header()
+{
+	m_buf.resize( header_size );
+	auto self( shared_from_this() );
+	asio::async_read( m_socket, asio::buffer( m_buf ),
+	[this, self]( asio::error_code ec, size_t )
+	{
+		if ( ec )
+		{
+			if ( !m_crashed ) m_scenario.failed( *this, "receive: " + ec.message() );
+			return;
+		}
+		uint32_t size;
+		std::memcpy( &size, &m_buf[0], 4 );
+		do_read_body( size );
+	} );
+}
+
+
+void Player::do_read_body( size_t size )
+{
+	m_buf.resize( header_size + size );
+	auto self( shared_from_this() );
+	asio::async_read( m_socket, asio::buffer( &m_buf[header_size], size ),
+	[this, self]( asio::error_code ec, size_t )
+	{
+		if ( ec )
+		{
+			if ( !m_crashed ) m_scenario.failed( *this, "receive: " + ec.message() );
+			return;
+		}
+		uint16_t cmd;
+		uint32_t id1, id2;
+		std::memcpy( &cmd, &m_buf[4],  2 );
+		std::memcpy( &id1, &m_buf[6],  4 );
+		std::memcpy( &id2, &m_buf[10], 4 );
+		handle( cmd, id1, id2, &m_buf[header_size], m_buf.size() - header_size );
+		if ( !m_crashed ) do_read_header();
+	} );
+}
+
+
+void Player::handle( unsigned short cmd, unsigned int id1, unsigned int id2, const unsigned char* data, size_t size )
+{
+	if      ( 0x19b == cmd && !m_id )//login reply
+	{
+		m_id = id1;
+		m_scenario.logged_in( *this );
+	}
+	else if ( 0x19d == cmd && id1 == m_id )//own room created
+	{
+		m_scenario.created( m_room );
+	}
+	else if ( 0x19f == cmd && is_host() )//a player joined a room
+	{
+		m_scenario.joined( m_room, id1 );
+	}
+	else if ( 0x1a3 == cmd && !m_playing && id1 == m_scenario.host_id( m_room ) )//own game started
+	{
+		m_playing = true;
+		m_scenario.started( *this );
+		tick();
+	}
+	else if ( 0x4b0 == cmd && m_playing )
+	{
+		Clock::rep sent = 0;
+		if ( sizeof( sent ) <= size ) std::memcpy( &sent, data, sizeof( sent ) );
+		m_scenario.relayed( us_since( Clock::time_point( Clock::duration( sent ) ) ) );
+		++m_scenario.received;
+		send( 0x456, m_id, 0 );
+	}
+	else if ( ( 0x1bd == cmd || 0x1be == cmd ) && id2 == m_id )
+	{
+		m_scenario.new_host( m_room, 0x1bd == cmd );
+	}
+}
+
+
+//sends game data, the receivers take the latency from the timestamp
+void Player::tick()
+{
+	if ( !m_playing || m_crashed ) return;
+	std::string body( std::max<size_t>( m_scenario.settings().size, sizeof( Clock::rep ) ), 'x' );
+	const Clock::rep now = Clock::now().time_since_epoch().count();
+	std::memcpy( &body[0], &now, sizeof( now ) );
+	send( 0x4b0, m_id, 0, body );
+	++m_scenario.sent;
+
+	m_timer.expires_from_now( std::chrono::microseconds( 1000000 / std::max( 1u, m_scenario.settings().rate ) ) );
+	auto self( shared_from_this() );
+	m_timer.async_wait( [this, self]( asio::error_code ec ) { if ( !ec ) tick(); } );
+}
+
+
+void Player::start_game( const std::vector<unsigned int>& ids )
+{
+	//0x1a2: number of players, then ID and status byte of each
+	std::string body( 4 + ids.size() * 5, '\0' );
+	const uint32_t count = static_cast<uint32_t>( ids.size() );
+	std::memcpy( &body[0], &count, 4 );
+	for ( size_t i = 0; ids.size() > i; ++i )
+	{
+		std::memcpy( &body[4 + i * 5], &ids[i], 4 );
+		body[4 + i * 5 + 4] = ids[i] == m_id ? 5 : 3;
+	}
+	send( 0x1a2, m_id, 0, body );
+}
+
+
+void Player::stop()
+{
+	m_playing = false;
+	m_timer.cancel();
+}
+
+
+void Player::crash( bool reset )
+{
+	stop();
+	asio::error_code ec;
+	if ( reset )
+	{
+		m_socket.set_option( asio::socket_base::linger( true, 0 ), ec );
+		m_socket.close( ec );
+	}
+	else
+	{
+		//pending operations are cancelled, the connection stays open
+		m_socket.cancel( ec );
+	}
+	m_crashed = true;
+}
+
+
+Scenario::Scenario( asio::io_service& io_service, const Settings& settings ) :
+	sent              ( 0 ),
+	received          ( 0 ),
+	m_io_service      ( io_service ),
+	m_settings        ( settings ),
+	m_rooms           ( settings.rooms ),
+	m_timer           ( io_service ),
+	m_playing         ( 0 ),
+	m_second          ( 0 ),
+	m_transferring    ( false ),
+	m_deadline        ( Clock::now() + std::chrono::seconds( settings.timeout ) ),
+	m_max_queued_bytes( 0 ),
+	m_stats           ( nullptr )
+{
+#ifdef __linux__
+	if ( !settings.stats_shm.empty() )
+	{
+		std::string name( settings.stats_shm );
+		if ( '/' != name[0] ) name.insert( 0, "/" );
+		const int fd = ::shm_open( name.c_str(), O_RDONLY, 0 );
+		void* p = 0 <= fd ? ::mmap( nullptr, sizeof( SharedStats ), PROT_READ, MAP_SHARED, fd, 0 ) : MAP_FAILED;
+		if ( 0 <= fd ) ::close( fd );
+		if ( MAP_FAILED != p && SharedStats::magic == static_cast<const SharedStats*>( p )->header.magic
+		     && SharedStats::version == static_cast<const SharedStats*>( p )->header.version )
+		{
+			m_stats = static_cast<const SharedStats*>( p );
+		}
+		else
+		{
+			std::cerr << "Could not open statistics segment " << name << ", send queues are not shown\n";
+		}
+	}
+#endif
+
+	for ( unsigned int r = 0; settings.rooms > r; ++r )
+	{
+		for ( unsigned int i = 0; settings.players > i; ++i )
+		{
+			auto player = std::make_shared<Player>( io_service, *this, r, i );
+			m_rooms[r].players.push_back( player );
+			player->start( 0 == i ? settings.hosts_via : settings.server );
+		}
+	}
+	every_second();
+}
+
+
+//the room is created once everyone who is going to join knows their ID
+void Scenario::logged_in( Player& player )
+{
+	auto& room = m_rooms[player.room()];
+	if ( room.players.size() != ++room.logged_in ) return;
+
+	//0x19c: 8, 0, room description, room info, 0, 0
+	const auto& host = *room.players[0];
+	const std::string desc = "\"load" + std::to_string( host.room() ) + "\"\t\"\"\t008C7";
+	std::string body( "\x08\0\0\0\0", 5 );
+	body += static_cast<char>( desc.size() ) + desc + '\x01' + '0' + std::string( 6, '\0' );
+	room.players[0]->send( 0x19c, host.id(), 0, body );
+}
+
+
+void Scenario::created( unsigned int room )
+{
+	for ( const auto& player : m_rooms[room].players )
+	{
+		if ( player->is_host() ) continue;
+		const uint32_t host_id = m_rooms[room].players[0]->id();
+		player->send( 0x19e, player->id(), 0, std::string( reinterpret_cast<const char*>( &host_id ), 4 ) );
+	}
+	if ( 1 == m_rooms[room].players.size() ) joined( room, 0 );
+}
+
+
+void Scenario::joined( unsigned int room, unsigned int id )
+{
+	auto& r = m_rooms[room];
+	const bool member = std::any_of( r.players.begin() + 1, r.players.end(), [id]( const std::shared_ptr<Player>& p ) { return p->id() == id; } );
+	if ( member ) ++r.joined;
+	if ( r.players.size() - 1 != r.joined ) return;
+
+	std::vector<unsigned int> ids;
+	for ( const auto& player : r.players ) ids.push_back( player->id() );
+	r.players[0]->start_game( ids );
+}
+
+
+void Scenario::started( Player& )
+{
+	if ( m_settings.rooms * m_settings.players != ++m_playing ) return;
+	std::cout << "all " << m_playing << " players in game" << std::endl;
+	m_second   = 0;
+	m_deadline = Clock::now() + std::chrono::seconds( m_settings.duration );
+}
+
+
+void Scenario::new_host( unsigned int room, bool is_new_host )
+{
+	auto& r = m_rooms[room];
+	if ( !m_transferring ) return;
+	const auto us = us_since( r.crashed );
+	if ( is_new_host ) r.new_host_us = us;
+	if ( r.players.size() - 1 == ++r.informed ) r.transfer_us = us;
+
+	const bool done = std::all_of( m_rooms.begin(), m_rooms.end(), []( const Room& r ) { return 0 <= r.transfer_us; } );
+	if ( done ) finish();
+}
+
+
+void Scenario::failed( const Player& player, const std::string& what )
+{
+	std::cerr << "[ERROR] room " << player.room() << " player " << player.id() << ": " << what << "\n";
+}
+
+
+/*
+	Prints the relay latencies of the last second and the send queues of
+	the server (also while waiting for the host transfer, when they can
+	pile up for a frozen host); ends the game after --duration and the
+	run after the host transfer.
+*/
+void Scenario::every_second()
+{
+	const bool playing = m_settings.rooms * m_settings.players == m_playing;
+	if ( playing )
+	{
+		std::cout << std::fixed << std::setprecision( 2 ) << std::setw( 4 ) << ++m_second << " s  "
+		          << std::setw( 7 ) << m_interval.count() << " relayed  p50 " << std::setw( 7 ) << m_interval.percentile( 500 )
+		          << " ms  p99 " << std::setw( 7 ) << m_interval.percentile( 990 ) << " ms  max " << std::setw( 7 )
+		          << m_interval.percentile( 1000 ) << " ms";
+		SharedStats::Data data;
+		if ( sample_server( data ) )
+		{
+			m_max_queued_bytes = std::max<unsigned long long>( m_max_queued_bytes, data.max_queued_bytes );
+			std::cout << "  server queued " << data.queued_packets << " buffers, " << data.queued_bytes << " bytes (max "
+			          << data.max_queued_bytes << " in one)";
+		}
+		std::cout << std::endl;
+	}
+	m_total.add( m_interval );
+	m_interval.clear();
+
+	if ( Clock::now() >= m_deadline )
+	{
+		if ( !playing )
+		{
+			std::cerr << "[ERROR] only " << m_playing << " of " << m_settings.rooms * m_settings.players
+			          << " players got into a game within " << m_settings.timeout << " s\n";
+			m_io_service.stop();
+			return;
+		}
+		if ( m_transferring || m_settings.transfer.empty() )
+		{
+			finish();
+			return;
+		}
+		end_game();
+	}
+	m_timer.expires_from_now( std::chrono::seconds( 1 ) );
+	m_timer.async_wait( [this]( asio::error_code ec ) { if ( !ec ) every_second(); } );
+}
+
+
+//the hosts crash, the other players go on until they know the new host
+void Scenario::end_game()
+{
+	m_transferring = true;
+	m_deadline     = Clock::now() + std::chrono::seconds( m_settings.timeout );
+	for ( auto& room : m_rooms )
+	{
+		room.crashed = Clock::now();
+		room.players[0]->crash( "reset" == m_settings.transfer );
+	}
+	std::cout << "hosts crashed (" << m_settings.transfer << "), waiting for the host transfer" << std::endl;
+}
+
+
+void Scenario::finish()
+{
+	for ( auto& room : m_rooms )
+	{
+		for ( auto& player : room.players ) player->stop();
+	}
+
+	std::cout << std::fixed << std::setprecision( 2 )
+	          << "game data: " << sent << " sent, " << received << " received\n"
+	          << "relay latency: p50 " << m_total.percentile( 500 ) << " ms, p90 " << m_total.percentile( 900 )
+	          << " ms, p99 " << m_total.percentile( 990 ) << " ms, max " << m_total.percentile( 1000 ) << " ms\n";
+	if ( m_stats ) std::cout << "server send queue: max " << m_max_queued_bytes << " bytes in one\n";
+	if ( m_transferring )
+	{
+		for ( size_t r = 0; m_rooms.size() > r; ++r )
+		{
+			const auto& room = m_rooms[r];
+			std::cout << "room " << r << " host transfer: ";
+			if ( 0 > room.new_host_us ) std::cout << "new host not told";
+			else                        std::cout << "new host told after " << room.new_host_us / 1000.0 << " ms";
+			if ( 0 > room.transfer_us ) std::cout << ", " << room.informed << " of " << room.players.size() - 1 << " players told\n";
+			else                        std::cout << ", all players after " << room.transfer_us / 1000.0 << " ms\n";
+		}
+	}
+	std::cout << std::flush;
+	m_io_service.stop();
+}
+
+
+bool Scenario::sample_server( SharedStats::Data& data ) const
+{
+	if ( !m_stats ) return false;
+	//sequence lock, see SharedStats
+	for ( ;; )
+	{
+		const auto s1 = m_stats->header.seq.load( std::memory_order_acquire );
+		if ( s1 & 1 )
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		std::memcpy( &data, &m_stats->data, sizeof( data ) );
+		std::atomic_thread_fence( std::memory_order_acquire );
+		if ( s1 == m_stats->header.seq.load( std::memory_order_relaxed ) ) return true;
+	}
+}
+
+
+static void print_usage()
+{
+	std::cerr << "Usage: cossacks3-load [options] SERVER_HOST:SERVER_PORT\n"
+	          << "  --rooms N          rooms to play in (default 4)\n"
+	          << "  --players N        players per room, host included (default 4)\n"
+	          << "  --rate N           game data packets per player and second (default 20)\n"
+	          << "  --size BYTES       size of the game data (default 100)\n"
+	          << "  --duration S       seconds to play (default 10)\n"
+	          << "  --transfer MODE    then the hosts crash: reset or silent; measures the host transfer\n"
+	          << "  --timeout S        for getting into the game and the host transfer (default 30)\n"
+	          << "  --hosts-via H:P    connect the hosts here instead (another cossacks3-impair)\n"
+	          << "  --stats-shm NAME   sample the server's send queues (server started with --stats-shm)\n";
+}
+
+
+static bool resolve( asio::io_service& io_service, const std::string& address, tcp::endpoint& ep )
+{
+	const auto colon = address.rfind( ':' );
+	if ( std::string::npos == colon ) return false;
+	tcp::resolver resolver( io_service );
+	ep = *resolver.resolve( address.substr( 0, colon ), address.substr( colon + 1 ) ).begin();
+	return true;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	Settings settings;
+	std::string server, hosts_via;
+	for ( int i = 1; argc > i; ++i )
+	{
+		const std::string arg( argv[i] );
+		if ( 0 != arg.compare( 0, 2, "--" ) )
+		{
+			server = arg;
+			continue;
+		}
+		if ( argc <= i + 1 )
+		{
+			print_usage();
+			return 2;
+		}
+		const char* value = argv[++i];
+		if      ( "--rooms"     == arg ) settings.rooms     = std::max( 1, std::atoi( value ) );
+		else if ( "--players"   == arg ) settings.players   = std::max( 1, std::atoi( value ) );
+		else if ( "--rate"      == arg ) settings.rate      = std::max( 1, std::atoi( value ) );
+		else if ( "--size"      == arg ) settings.size      = std::atoi( value );
+		else if ( "--duration"  == arg ) settings.duration  = std::atoi( value );
+		else if ( "--timeout"   == arg ) settings.timeout   = std::max( 1, std::atoi( value ) );
+		else if ( "--transfer"  == arg ) settings.transfer  = value;
+		else if ( "--hosts-via" == arg ) hosts_via          = value;
+		else if ( "--stats-shm" == arg ) settings.stats_shm = value;
+		else
+		{
+			print_usage();
+			return 2;
+		}
+	}
+	if ( !settings.transfer.empty() && "reset" != settings.transfer && "silent" != settings.transfer )
+	{
+		print_usage();
+		return 2;
+	}
+	//a host transfer needs someone to take over
+	if ( !settings.transfer.empty() && 2 > settings.players ) settings.players = 2;
+
+	try
+	{
+		asio::io_service io_service;
+		if ( !resolve( io_service, server, settings.server ) )
+		{
+			print_usage();
+			return 2;
+		}
+		settings.hosts_via = settings.server;
+		if ( !hosts_via.empty() && !resolve( io_service, hosts_via, settings.hosts_via ) )
+		{
+			print_usage();
+			return 2;
+		}
+		Scenario scenario( io_service, settings );
+		io_service.run();
+	}
+	catch ( const std::exception& e )
+	{
+		std::cerr << "[ERROR] " << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
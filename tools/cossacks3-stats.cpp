@@ -0,0 +1,126 @@
+/*
+	Copyright (c) 2018 Ereb @ habrahabr.ru
+
+	This source code is distributed under the MIT license.
+	See LICENSE.MIT for details.
+*/
+
+/*
+	Reads the statistics segment of a server started with --stats-shm NAME
+	and prints it, once or every MS milliseconds:
+
+	$ cossacks3-stats NAME [MS]
+
+	Reading takes no system calls after the segment is mapped and does
+	not involve the server at all. Linux only.
+*/
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../src/SharedStats.hpp"
+
+
+//copies the data block under the sequence lock, see SharedStats
+static SharedStats::Data read_data( const SharedStats& stats )
+{
+	SharedStats::Data data;
+	for ( ;; )
+	{
+		const auto s1 = stats.header.seq.load( std::memory_order_acquire );
+		if ( s1 & 1 )
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		std::memcpy( &data, &stats.data, sizeof( data ) );
+		std::atomic_thread_fence( std::memory_order_acquire );
+		if ( s1 == stats.header.seq.load( std::memory_order_relaxed ) ) return data;
+	}
+}
+
+
+static void print( std::ostream& out, const SharedStats::Data& d )
+{
+	out << "up " << ( d.published_ms - d.started_ms ) / 1000 << " s\n"
+	    << "partitions " << d.partitions << ", clients " << d.clients
+	    << ", players " << d.players << ", rooms " << d.rooms << "\n"
+	    << "send queues: " << d.queued_packets << " buffers, " << d.queued_bytes
+	    << " bytes (max " << d.max_queued_bytes << " bytes in one)\n";
+
+	out << "event loop busy ";
+	if ( 0 <= d.loop_busy_permille ) out << d.loop_busy_permille / 10.0 << "%";
+	else                             out << "-";
+	out << ", " << d.loop_stalls << " stalls, lag (" << d.loop_probes << " probes, max "
+	    << d.loop_lag_max_us / 1000.0 << " ms):";
+	for ( unsigned int bucket = 0; SharedStats::lag_buckets > bucket; ++bucket )
+	{
+		if ( !d.loop_lag[bucket] ) continue;
+		if ( SharedStats::lag_buckets - 1 > bucket ) out << " <" << ( 1 << bucket ) << " ms " << d.loop_lag[bucket];
+		else                                         out << " longer " << d.loop_lag[bucket];
+	}
+	out << "\n";
+
+	out << std::setw( 6 ) << "cmd" << std::setw( 12 ) << "in" << std::setw( 14 ) << "in bytes"
+	    << std::setw( 12 ) << "out" << std::setw( 14 ) << "out bytes" << "\n";
+	for ( uint32_t i = 0; d.commands > i && SharedStats::max_commands > i; ++i )
+	{
+		const auto& c = d.command[i];
+		out << "   " << std::hex << std::setw( 3 ) << std::setfill( '0' ) << c.cmd << std::dec << std::setfill( ' ' )
+		    << std::setw( 12 ) << c.in_packets << std::setw( 14 ) << c.in_bytes
+		    << std::setw( 12 ) << c.out_packets << std::setw( 14 ) << c.out_bytes << "\n";
+	}
+	out << std::flush;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	if ( 2 > argc || 3 < argc )
+	{
+		std::cerr << "Usage: cossacks3-stats NAME [MS]\n";
+		return 2;
+	}
+	std::string name( argv[1] );
+	if ( '/' != name[0] ) name.insert( 0, "/" );
+	const long interval_ms = 3 == argc ? std::atol( argv[2] ) : 0;
+
+	const int fd = ::shm_open( name.c_str(), O_RDONLY, 0 );
+	if ( 0 > fd )
+	{
+		std::cerr << "Could not open " << name << ": " << std::strerror( errno ) << "\n";
+		return 1;
+	}
+	void* p = ::mmap( nullptr, sizeof( SharedStats ), PROT_READ, MAP_SHARED, fd, 0 );
+	::close( fd );
+	if ( MAP_FAILED == p )
+	{
+		std::cerr << "Could not map " << name << ": " << std::strerror( errno ) << "\n";
+		return 1;
+	}
+
+	const auto& stats = *static_cast<const SharedStats*>( p );
+	if ( SharedStats::magic != stats.header.magic || SharedStats::version != stats.header.version
+	     || sizeof( SharedStats ) != stats.header.size )
+	{
+		std::cerr << name << " is not a statistics segment of this version\n";
+		return 1;
+	}
+
+	for ( ;; )
+	{
+		print( std::cout, read_data( stats ) );
+		if ( 0 >= interval_ms ) return 0;
+		std::this_thread::sleep_for( std::chrono::milliseconds( interval_ms ) );
+		std::cout << "\n";
+	}
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Plays games on a local server through cossacks3-impair with a few
+# typical bad links and prints relay latency, server send queues and
+# host transfer times of each (see cossacks3-impair.cpp and
+# cossacks3-load.cpp). Logs are written to the working directory.
+#
+# Usage: tools/impairment-scenarios.sh [BINDIR] [DURATION]
+#   BINDIR holds cossacks3-server, cossacks3-impair and cossacks3-load
+#   (default: the working directory), DURATION is seconds per game (default 10)
+
+BIN=${1:-.}
+DURATION=${2:-10}
+PORT=31700
+PROXY=31701
+SHM=cossacks3-scenarios
+
+"$BIN/cossacks3-server" --port $PORT --max-per-address 1000 --stats-shm $SHM > scenarios-server.log 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT
+sleep 1
+
+# scenario NAME "LOAD OPTIONS" [IMPAIR OPTIONS]
+scenario()
+{
+	NAME=$1
+	LOAD=$2
+	shift 2
+	echo "== $NAME: ${*:-no impairment}; $LOAD"
+	"$BIN/cossacks3-impair" "$@" $PROXY 127.0.0.1:$PORT > "scenarios-$NAME.log" 2>&1 &
+	PROXY_PID=$!
+	sleep 0.5
+	"$BIN/cossacks3-load" --duration "$DURATION" --stats-shm $SHM $LOAD 127.0.0.1:$PROXY
+	kill $PROXY_PID
+	wait $PROXY_PID 2>/dev/null
+	echo
+}
+
+scenario clean    "--transfer reset"
+scenario jitter   "--transfer reset"  --delay 5 --jitter 20
+scenario stalls   "--transfer reset"  --stall-every 3 --stall 500
+scenario capped   "--size 1000"       --rate 512 --buffer 16384
+scenario frozen   "--transfer silent" --buffer 4096